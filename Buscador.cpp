@@ -8,27 +8,107 @@
  * -------------------------------------------------------------------------
  * Este programa permite:
  *  - Cargar correos desde un archivo de texto.
- *  - Crear correos nuevos con indexación automática.
- *  - Buscar correos por remitente.
- *  - Buscar correos por palabra clave usando matriz dispersa.
- *  - Ordenar correos por fecha mediante un árbol binario.
+ *  - Guardar y recuperar los índices en una instantánea binaria.
+ *  - Opcionalmente (--cuerpos-en-disco), dejar los cuerpos en un archivo,
+ *    comprimidos por bloques, y leerlos solo al abrir un correo.
+ *  - Registrar los correos nuevos en un diario de solo escritura al final.
+ *  - Crear correos nuevos con indexación automática, y borrarlos o editarlos.
+ *  - Buscar correos por remitente, por dominio o por comienzo de dirección.
+ *  - Buscar correos por palabra clave usando un índice invertido, con
+ *    consultas booleanas (AND, OR, NOT), limitadas a un campo (asunto:,
+ *    cuerpo:, de:) y ranking por relevancia BM25.
+ *  - Ordenar correos por fecha mediante árboles AVL particionados por mes.
+ *  - Responder consultas por lotes (--lote [archivo]), una por línea y en
+ *    paralelo, con los IDs o líneas JSON (--json) como salida.
+ *  - Atender búsquedas y altas por HTTP (--servidor [[host:]puerto], solo
+ *    en 127.0.0.1 si no se indica otra dirección) con un bucle
+ *    de eventos y una reserva de hilos, compartiendo los índices cargados.
+ *  - Medir las operaciones sobre un corpus sintético (--benchmark) y, con
+ *    --estadisticas, informar latencias, tamaños de los índices y, si se
+ *    compila con -DBUSCADOR_CONTAR_ASIGNACIONES, asignaciones de memoria.
  * 
  * Estructuras empleadas:
+ *  - Almacén central de correos (cada correo se guarda una sola vez)
+ *  - Almacén de cuerpos en disco, de solo agregar, comprimido por bloques
+ *    (LZ77 con diccionario entrenado) y con caché LRU de bloques (opcional)
  *  - Mapas hash (unordered_map)
- *  - Árbol binario de búsqueda
- *  - Matriz dispersa (representada como mapas anidados)
+ *  - Tabla de remitentes internados (dirección normalizada -> ID denso),
+ *    ordenados por dirección y por dominio invertido en tries
+ *  - Segmentos de índice inmutables publicados en vistas atómicas: un
+ *    escritor y muchos lectores que nunca se bloquean. Un hilo en segundo
+ *    plano los fusiona por niveles de tamaño (estilo LSM)
+ *  - Árbol AVL (árbol binario de búsqueda autobalanceado)
+ *  - Matriz dispersa (guardada transpuesta, como listas de postings)
+ *  - Índice invertido (término -> lista ordenada de IDs, comprimida con
+ *    diferencias y varints por bloques, con saltos entre bloques)
+ *  - Trie de términos (búsqueda por prefijo y sugerencias aproximadas)
+ *  - Caché LRU de resultados por consulta normalizada, válida solo para la
+ *    vista de índices con que se calculó
  * 
  * Interfaz:
- *  - Basada en terminal con códigos ANSI de color.
+ *  - Basada en terminal con códigos ANSI de color, como cliente delgado de
+ *    MotorBusqueda, que concentra el arranque, las escrituras y las
+ *    búsquedas sin entrada ni salida por consola.
  * -------------------------------------------------------------------------
  */
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <climits>
+#include <cerrno>
+#include <cmath>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
 #include <fstream>
-#include <sstream>
+#include <functional>
+#include <iterator>
 #include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <thread>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 using namespace std;
 
 // ============================================================================
@@ -40,167 +120,6963 @@ const string WHITE = "\033[37m";
 const string BOLD  = "\033[1m";
 const string RESET = "\033[0m";
 
-/**
- * @brief Limpia la pantalla (solo Windows).
- */
-void limpiarPantalla() {
-    system("cls");
+/// Cantidad de correos que se muestran por página en los listados.
+const size_t TAM_PAGINA = 20;
+
+/// Distancia de edición máxima de las sugerencias de términos.
+const int MAX_DISTANCIA_SUGERENCIA = 2;
+/// Cantidad de sugerencias que se muestran por término.
+const size_t MAX_SUGERENCIAS = 5;
+
+/**
+ * @brief Limpia la pantalla con la secuencia ANSI, sin lanzar un proceso.
+ */
+void limpiarPantalla() {
+    cout << "\033[2J\033[H" << flush;
+}
+
+// ============================================================================
+// ESTRUCTURAS
+// ============================================================================
+
+/**
+ * @brief Fecha empaquetada en 32 bits: año << 9 | mes << 5 | día. El orden
+ *        numérico es el cronológico, así que comparar fechas es comparar
+ *        enteros, y mesDe() sale con un desplazamiento.
+ */
+using Fecha = uint32_t;
+
+/// Fecha mayor que cualquier fecha real (extremo abierto de un intervalo).
+const Fecha FECHA_MAXIMA = UINT32_MAX;
+
+constexpr Fecha empaquetarFecha(uint32_t anio, uint32_t mes, uint32_t dia) {
+    return anio << 9 | mes << 5 | dia;
+}
+
+/// Mes de una fecha (año << 4 | mes), que identifica su partición.
+inline uint32_t mesDe(Fecha f) { return f >> 5; }
+
+/// Fecha anterior a todos los días de un mes (el día 0).
+inline Fecha inicioMes(uint32_t mes) { return mes << 5; }
+
+/**
+ * @brief Indica si una fecha empaquetada corresponde a un día con mes de
+ *        1 a 12 y día de 1 a 31.
+ */
+inline bool fechaEnRango(Fecha f) {
+    uint32_t mes = (f >> 5) & 15, dia = f & 31;
+    return f >> 9 <= 9999 && mes >= 1 && mes <= 12 && dia >= 1;
+}
+
+/**
+ * @brief Lee una fecha AAAA-MM-DD. Con `parcial` también acepta AAAA y
+ *        AAAA-MM, que valen como el comienzo de ese año o mes (para los
+ *        extremos de un intervalo).
+ * @return false si el texto no tiene esa forma o el mes o el día no existen.
+ */
+bool leerFecha(string_view texto, Fecha& fecha, bool parcial = false) {
+    auto numero = [&](size_t ini, size_t n, uint32_t& v) {
+        v = 0;
+        for (size_t i = ini; i < ini + n; i++) {
+            if (texto[i] < '0' || texto[i] > '9') return false;
+            v = v * 10 + (uint32_t)(texto[i] - '0');
+        }
+        return true;
+    };
+    size_t largo = texto.size();
+    if (largo != 10 && !(parcial && (largo == 4 || largo == 7))) return false;
+    uint32_t anio, mes = 0, dia = 0;
+    if (!numero(0, 4, anio)) return false;
+    if (largo >= 7 && (texto[4] != '-' || !numero(5, 2, mes) || mes < 1 || mes > 12)) return false;
+    if (largo == 10 && (texto[7] != '-' || !numero(8, 2, dia) || dia < 1 || dia > 31)) return false;
+    fecha = empaquetarFecha(anio, mes, dia);
+    return true;
+}
+
+/**
+ * @brief Fecha en la forma AAAA-MM-DD.
+ */
+string textoFecha(Fecha f) {
+    char texto[16];
+    snprintf(texto, sizeof texto, "%04u-%02u-%02u", f >> 9, (f >> 5) & 15, f & 31);
+    return texto;
+}
+
+/**
+ * @struct Correo
+ * @brief Representa un correo con metadatos e ID autogenerado.
+ */
+struct Correo {
+    int id;
+    string remitente;
+    string asunto;
+    string cuerpo;                  ///< Vacío si el cuerpo está en el almacén de cuerpos
+    Fecha fecha;                    ///< Se lee una sola vez al cargar; textoFecha() la muestra
+    uint32_t largoCuerpo = 0;       ///< Bytes del cuerpo en el almacén de cuerpos (0 = en memoria)
+    uint64_t posicionCuerpo = 0;    ///< Posición del cuerpo en el almacén de cuerpos
+};
+
+/**
+ * @struct NodoCorreo
+ * @brief Nodo del árbol AVL que apunta a un correo del almacén.
+ */
+struct NodoCorreo {
+    const Correo* data;
+    NodoCorreo* izq;
+    NodoCorreo* der;
+    int altura;
+    NodoCorreo(const Correo* c) : data(c), izq(nullptr), der(nullptr), altura(1) {}
+};
+
+/**
+ * @class ArbolCorreos
+ * @brief Árbol AVL ordenado por fecha del correo (y por ID en empates).
+ *        Cada comparación es entre dos fechas empaquetadas.
+ *
+ * Los archivos de correo suelen venir ordenados por fecha, lo que
+ * convertía el árbol binario simple en una lista enlazada. El AVL mantiene
+ * la altura en O(log n), por lo que insertar cuesta O(log n) y la
+ * profundidad de la recursión queda acotada. El recorrido inOrden es
+ * iterativo con una pila explícita.
+ */
+class ArbolCorreos {
+private:
+    NodoCorreo* raiz;
+
+    static int altura(NodoCorreo* n) { return n ? n->altura : 0; }
+
+    static void actualizar(NodoCorreo* n) {
+        n->altura = 1 + max(altura(n->izq), altura(n->der));
+    }
+
+    static NodoCorreo* rotarDerecha(NodoCorreo* y) {
+        NodoCorreo* x = y->izq;
+        y->izq = x->der;
+        x->der = y;
+        actualizar(y);
+        actualizar(x);
+        return x;
+    }
+
+    static NodoCorreo* rotarIzquierda(NodoCorreo* x) {
+        NodoCorreo* y = x->der;
+        x->der = y->izq;
+        y->izq = x;
+        actualizar(x);
+        actualizar(y);
+        return y;
+    }
+
+    /**
+     * @brief Restablece la propiedad AVL en un nodo tras una inserción.
+     */
+    static NodoCorreo* balancear(NodoCorreo* n) {
+        actualizar(n);
+        int factor = altura(n->izq) - altura(n->der);
+        if (factor > 1) {
+            if (altura(n->izq->izq) < altura(n->izq->der))
+                n->izq = rotarIzquierda(n->izq);
+            return rotarDerecha(n);
+        }
+        if (factor < -1) {
+            if (altura(n->der->der) < altura(n->der->izq))
+                n->der = rotarDerecha(n->der);
+            return rotarIzquierda(n);
+        }
+        return n;
+    }
+
+    /**
+     * @brief Arma el subárbol balanceado de ordenados[ini, fin).
+     */
+    static NodoCorreo* construir(const vector<const Correo*>& ordenados, size_t ini, size_t fin) {
+        if (ini >= fin) return nullptr;
+        size_t medio = ini + (fin - ini) / 2;
+        NodoCorreo* n = new NodoCorreo(ordenados[medio]);
+        n->izq = construir(ordenados, ini, medio);
+        n->der = construir(ordenados, medio + 1, fin);
+        actualizar(n);
+        return n;
+    }
+
+    /**
+     * @brief Inserta un nodo basado en comparación de fecha.
+     *        La profundidad de la recursión es O(log n).
+     */
+    NodoCorreo* insertar(NodoCorreo* nodo, const Correo* c) {
+        if (!nodo) return new NodoCorreo(c);
+        if (menor(c, nodo->data))
+            nodo->izq = insertar(nodo->izq, c);
+        else
+            nodo->der = insertar(nodo->der, c);
+        return balancear(nodo);
+    }
+
+public:
+    /**
+     * @brief Orden total: por fecha y, a igual fecha, por orden de llegada.
+     */
+    static bool menor(const Correo* a, const Correo* b) {
+        if (a->fecha != b->fecha) return a->fecha < b->fecha;
+        return a->id < b->id;
+    }
+
+    /**
+     * @class Cursor
+     * @brief Recorrido perezoso en orden de fecha sobre el intervalo
+     *        [desde, hasta). Guarda solo la pila de ancestros pendientes
+     *        (O(log n)), así que avanzar no copia ni materializa correos.
+     */
+    class Cursor {
+    private:
+        vector<NodoCorreo*> pila;
+        Fecha hasta = 0;
+
+        void bajarIzquierda(NodoCorreo* n) {
+            while (n) {
+                pila.push_back(n);
+                n = n->izq;
+            }
+        }
+
+        friend class ArbolCorreos;
+
+    public:
+        /**
+         * @brief Indica si quedan correos dentro del intervalo.
+         */
+        bool valido() const {
+            return !pila.empty() && pila.back()->data->fecha < hasta;
+        }
+
+        /**
+         * @brief Correo en la posición actual (requiere valido()).
+         */
+        const Correo* actual() const { return pila.back()->data; }
+
+        /**
+         * @brief Avanza al siguiente correo en orden de fecha.
+         */
+        void avanzar() {
+            NodoCorreo* n = pila.back();
+            pila.pop_back();
+            bajarIzquierda(n->der);
+        }
+
+        /**
+         * @brief Devuelve hasta `n` correos a partir de la posición actual
+         *        y deja el cursor en el primero no devuelto.
+         */
+        vector<const Correo*> siguientes(size_t n) {
+            vector<const Correo*> pagina;
+            while (pagina.size() < n && valido()) {
+                pagina.push_back(actual());
+                avanzar();
+            }
+            return pagina;
+        }
+    };
+
+    ArbolCorreos() : raiz(nullptr) {}
+    ArbolCorreos(const ArbolCorreos&) = delete;
+    ArbolCorreos& operator=(const ArbolCorreos&) = delete;
+    ArbolCorreos(ArbolCorreos&& otro) noexcept : raiz(otro.raiz) { otro.raiz = nullptr; }
+    ArbolCorreos& operator=(ArbolCorreos&& otro) noexcept {
+        swap(raiz, otro.raiz);
+        return *this;
+    }
+
+    /**
+     * @brief Libera los nodos (no los correos, que son del almacén).
+     */
+    ~ArbolCorreos() {
+        vector<NodoCorreo*> pila;
+        if (raiz) pila.push_back(raiz);
+        while (!pila.empty()) {
+            NodoCorreo* n = pila.back();
+            pila.pop_back();
+            if (n->izq) pila.push_back(n->izq);
+            if (n->der) pila.push_back(n->der);
+            delete n;
+        }
+    }
+
+    /**
+     * @brief Construye en O(n) un árbol perfectamente balanceado a partir
+     *        de correos ya ordenados. Requiere que el árbol esté vacío.
+     */
+    void construirDesdeOrdenados(const vector<const Correo*>& ordenados) {
+        raiz = construir(ordenados, 0, ordenados.size());
+    }
+
+    /**
+     * @brief Inserta un correo en el árbol. El correo debe pertenecer
+     *        al almacén central, pues el nodo solo guarda su dirección.
+     */
+    void insertar(const Correo& c) { raiz = insertar(raiz, &c); }
+
+    /**
+     * @brief Cursor sobre los correos con fecha en [desde, hasta).
+     *        Posicionarlo cuesta O(log n).
+     */
+    Cursor rango(Fecha desde = 0, Fecha hasta = FECHA_MAXIMA) const {
+        Cursor cur;
+        cur.hasta = hasta;
+        NodoCorreo* n = raiz;
+        while (n) {
+            if (n->data->fecha >= desde) {
+                cur.pila.push_back(n);
+                n = n->izq;
+            } else {
+                n = n->der;
+            }
+        }
+        return cur;
+    }
+
+    /**
+     * @brief Obtiene los correos con fecha en [desde, hasta) (sin copiarlos).
+     */
+    vector<const Correo*> obtenerRango(Fecha desde, Fecha hasta) const {
+        Cursor cur = rango(desde, hasta);
+        vector<const Correo*> lista;
+        for (; cur.valido(); cur.avanzar())
+            lista.push_back(cur.actual());
+        return lista;
+    }
+
+    /**
+     * @brief Obtiene los correos ordenados por fecha (sin copiarlos).
+     */
+    vector<const Correo*> obtenerOrdenados() const {
+        return obtenerRango(0, FECHA_MAXIMA);
+    }
+};
+
+/**
+ * @class CalendarioCorreos
+ * @brief Orden por fecha particionado por mes: un árbol AVL por cada mes
+ *        con correos, con los meses en orden cronológico.
+ *
+ * Un recorrido por fechas ubica con búsqueda binaria el primer mes del
+ * intervalo y se detiene en el primero que empieza después de `hasta`,
+ * así que los meses de afuera se saltan enteros sin tocar sus nodos. Cada
+ * árbol es además más bajo que uno con todo el segmento, y como los
+ * archivos suelen venir en orden de fecha casi todo se inserta en el
+ * último mes.
+ */
+class CalendarioCorreos {
+private:
+    struct Particion {
+        uint32_t mes;
+        ArbolCorreos arbol;
+    };
+
+    vector<Particion> particiones;   ///< En orden de mes, ninguna vacía
+
+    /// Posición de la primera partición con mes >= `mes`.
+    size_t buscarMes(uint32_t mes) const {
+        auto it = lower_bound(particiones.begin(), particiones.end(), mes,
+                              [](const Particion& p, uint32_t m) { return p.mes < m; });
+        return (size_t)(it - particiones.begin());
+    }
+
+public:
+    /**
+     * @class Cursor
+     * @brief Recorrido en orden de fecha sobre [desde, hasta): avanza por el
+     *        árbol de un mes y pasa al siguiente cuando se termina.
+     */
+    class Cursor {
+    private:
+        const vector<Particion>* particiones = nullptr;
+        size_t i = 0;
+        ArbolCorreos::Cursor actualMes;
+        Fecha hasta = 0;
+
+        void saltarTerminados() {
+            while (!actualMes.valido() && ++i < particiones->size() &&
+                   inicioMes((*particiones)[i].mes) < hasta)
+                actualMes = (*particiones)[i].arbol.rango(0, hasta);
+        }
+
+        friend class CalendarioCorreos;
+
+    public:
+        bool valido() const { return actualMes.valido(); }
+
+        /// Correo en la posición actual (requiere valido()).
+        const Correo* actual() const { return actualMes.actual(); }
+
+        void avanzar() {
+            actualMes.avanzar();
+            saltarTerminados();
+        }
+    };
+
+    /**
+     * @brief Inserta un correo del almacén en el árbol de su mes.
+     */
+    void insertar(const Correo& c) {
+        uint32_t mes = mesDe(c.fecha);
+        size_t i = particiones.empty() || particiones.back().mes != mes ? buscarMes(mes)
+                                                                        : particiones.size() - 1;
+        if (i == particiones.size() || particiones[i].mes != mes)
+            particiones.insert(particiones.begin() + i, Particion{mes, ArbolCorreos()});
+        particiones[i].arbol.insertar(c);
+    }
+
+    /**
+     * @brief Arma las particiones en O(n) a partir de correos ya ordenados.
+     *        Requiere que el calendario esté vacío.
+     */
+    void construirDesdeOrdenados(const vector<const Correo*>& ordenados) {
+        for (size_t ini = 0, fin; ini < ordenados.size(); ini = fin) {
+            uint32_t mes = mesDe(ordenados[ini]->fecha);
+            fin = ini + 1;
+            while (fin < ordenados.size() && mesDe(ordenados[fin]->fecha) == mes) fin++;
+            particiones.push_back({mes, ArbolCorreos()});
+            particiones.back().arbol.construirDesdeOrdenados(
+                vector<const Correo*>(ordenados.begin() + ini, ordenados.begin() + fin));
+        }
+    }
+
+    /// Cantidad de meses con correos.
+    size_t meses() const { return particiones.size(); }
+
+    /**
+     * @brief Cursor sobre los correos con fecha en [desde, hasta).
+     *        Posicionarlo cuesta O(log meses + log n).
+     */
+    Cursor rango(Fecha desde = 0, Fecha hasta = FECHA_MAXIMA) const {
+        Cursor cur;
+        cur.particiones = &particiones;
+        cur.hasta = hasta;
+        cur.i = buscarMes(mesDe(desde));
+        if (cur.i < particiones.size() && inicioMes(particiones[cur.i].mes) < hasta)
+            cur.actualMes = particiones[cur.i].arbol.rango(desde, hasta);
+        cur.saltarTerminados();
+        return cur;
+    }
+
+    /**
+     * @brief Obtiene los correos ordenados por fecha (sin copiarlos).
+     */
+    vector<const Correo*> obtenerOrdenados() const {
+        vector<const Correo*> lista;
+        for (const Particion& p : particiones) {
+            vector<const Correo*> mes = p.arbol.obtenerOrdenados();
+            lista.insert(lista.end(), mes.begin(), mes.end());
+        }
+        return lista;
+    }
+};
+
+/**
+ * @class TrieTerminos
+ * @brief Diccionario ordenado de los términos indexados.
+ *
+ * Los nodos viven en un vector y cada uno guarda sus hijos ordenados por
+ * carácter, por lo que un recorrido en profundidad visita los términos en
+ * orden lexicográfico. Los nodos terminales guardan el ID del término en la
+ * tabla de términos, así que el texto de cada término no se duplica.
+ *
+ * Permite buscar por prefijo en O(|prefijo| + resultados) y sugerir
+ * términos a distancia de edición acotada recorriendo el trie con una fila
+ * de la matriz de Levenshtein por nivel, podando las ramas que ya superan
+ * la distancia máxima.
+ */
+class TrieTerminos {
+private:
+    struct NodoTrie {
+        vector<pair<char, int>> hijos;     ///< (carácter, índice del hijo), ordenados
+        int termino = -1;                  ///< ID del término que termina aquí, si hay
+    };
+
+    vector<NodoTrie> nodos = vector<NodoTrie>(1);
+
+    int hijo(int n, char ch) const {
+        const auto& h = nodos[n].hijos;
+        auto it = lower_bound(h.begin(), h.end(), make_pair(ch, 0));
+        return (it != h.end() && it->first == ch) ? it->second : -1;
+    }
+
+    /**
+     * @brief Nodo alcanzado por un prefijo, o -1 si ningún término lo tiene.
+     */
+    int bajar(string_view prefijo) const {
+        int n = 0;
+        for (char ch : prefijo) {
+            n = hijo(n, ch);
+            if (n < 0) return -1;
+        }
+        return n;
+    }
+
+    void recolectar(int n, size_t limite, vector<int>& out) const {
+        vector<int> pila = {n};
+        while (!pila.empty() && out.size() < limite) {
+            int actual = pila.back();
+            pila.pop_back();
+            if (nodos[actual].termino >= 0) out.push_back(nodos[actual].termino);
+            const auto& h = nodos[actual].hijos;
+            for (auto it = h.rbegin(); it != h.rend(); ++it) pila.push_back(it->second);
+        }
+    }
+
+    void similaresDesde(int n, char ch, const vector<int>& filaPrevia, string_view palabra,
+                        int maxDist, vector<pair<int, int>>& out) const {
+        vector<int> fila(filaPrevia.size());
+        fila[0] = filaPrevia[0] + 1;
+        int minimo = fila[0];
+        for (size_t i = 1; i < fila.size(); i++) {
+            int costo = (palabra[i - 1] == ch) ? 0 : 1;
+            fila[i] = min({fila[i - 1] + 1, filaPrevia[i] + 1, filaPrevia[i - 1] + costo});
+            minimo = min(minimo, fila[i]);
+        }
+        if (nodos[n].termino >= 0 && fila.back() <= maxDist)
+            out.push_back({fila.back(), nodos[n].termino});
+        if (minimo > maxDist) return;
+        for (auto [c, h] : nodos[n].hijos)
+            similaresDesde(h, c, fila, palabra, maxDist, out);
+    }
+
+public:
+    /**
+     * @brief Agrega un término con su ID.
+     */
+    void insertar(string_view termino, int id) {
+        int n = 0;
+        for (char ch : termino) {
+            int h = hijo(n, ch);
+            if (h < 0) {
+                h = (int)nodos.size();
+                auto& hs = nodos[n].hijos;
+                hs.insert(lower_bound(hs.begin(), hs.end(), make_pair(ch, 0)), {ch, h});
+                nodos.emplace_back();
+            }
+            n = h;
+        }
+        nodos[n].termino = id;
+    }
+
+    /**
+     * @brief IDs de los términos que comienzan con `prefijo`, en orden
+     *        lexicográfico.
+     */
+    vector<int> conPrefijo(string_view prefijo, size_t limite = SIZE_MAX) const {
+        vector<int> out;
+        int n = bajar(prefijo);
+        if (n >= 0) recolectar(n, limite, out);
+        return out;
+    }
+
+    /**
+     * @brief Pares (distancia, ID) de los términos a distancia de edición
+     *        <= maxDist de `palabra`, ordenados por distancia y luego
+     *        alfabéticamente. La recursión tiene como profundidad el largo
+     *        del término más largo.
+     */
+    vector<pair<int, int>> similares(string_view palabra, int maxDist) const {
+        vector<pair<int, int>> out;
+        vector<int> fila(palabra.size() + 1);
+        for (size_t i = 0; i < fila.size(); i++) fila[i] = (int)i;
+        for (auto [c, h] : nodos[0].hijos)
+            similaresDesde(h, c, fila, palabra, maxDist, out);
+        stable_sort(out.begin(), out.end(), [](const auto& a, const auto& b) {
+            return a.first < b.first;
+        });
+        return out;
+    }
+};
+
+/**
+ * @class TablaTerminos
+ * @brief Internado de términos: cada término distinto recibe un ID denso en
+ *        orden de aparición. La búsqueda usa el término ya armado en el
+ *        buffer del tokenizador, así que un término conocido no reserva
+ *        memoria; solo los términos nuevos copian su texto.
+ */
+class TablaTerminos {
+private:
+    unordered_map<string, int> ids;
+    vector<const string*> textos;   ///< ID -> término (clave de `ids`, no se mueve)
+
+public:
+    /**
+     * @brief ID de un término, o -1 si no está en la tabla.
+     */
+    int buscar(const string& termino) const {
+        auto it = ids.find(termino);
+        return it == ids.end() ? -1 : it->second;
+    }
+
+    /**
+     * @brief ID de un término, agregándolo si es nuevo.
+     */
+    int internar(const string& termino) {
+        auto it = ids.find(termino);
+        if (it != ids.end()) return it->second;
+        auto ins = ids.emplace(termino, (int)textos.size());
+        textos.push_back(&ins.first->first);
+        return ins.first->second;
+    }
+
+    const string& texto(int id) const { return *textos[id]; }
+
+    size_t tamano() const { return textos.size(); }
+
+    void reservar(size_t n) {
+        ids.reserve(n);
+        textos.reserve(n);
+    }
+};
+
+// ============================================================================
+// ESTRUCTURAS GLOBALES
+// ============================================================================
+
+/// Correos por bloque del almacén.
+const size_t TAM_BLOQUE_ALMACEN = 1 << 14;
+/// Bloques que admite el directorio del almacén (2^30 correos en total).
+const size_t MAX_BLOQUES_ALMACEN = 1 << 16;
+
+/**
+ * @class AlmacenCorreos
+ * @brief Almacén central: dueño único de cada correo, indexado por ID.
+ *
+ * Los correos se guardan en bloques de tamaño fijo que nunca se mueven, y
+ * el directorio de bloques se reserva completo al inicio, así que agregar
+ * no invalida direcciones. Solo un escritor agrega; publica cada correo
+ * terminado incrementando la cantidad con semántica release, y los lectores
+ * la leen con acquire, por lo que buscar() no necesita candados.
+ */
+class AlmacenCorreos {
+private:
+    vector<unique_ptr<Correo[]>> bloques = vector<unique_ptr<Correo[]>>(MAX_BLOQUES_ALMACEN);
+    atomic<size_t> cantidad{0};
+
+public:
+    /**
+     * @brief Cantidad de correos publicados; sus IDs son 1..tamano().
+     */
+    size_t tamano() const { return cantidad.load(memory_order_acquire); }
+
+    /**
+     * @brief Correo con ese ID, o nullptr si aún no existe.
+     */
+    const Correo* buscar(int id) const {
+        if (id < 1 || (size_t)id > tamano()) return nullptr;
+        size_t i = (size_t)id - 1;
+        return &bloques[i / TAM_BLOQUE_ALMACEN][i % TAM_BLOQUE_ALMACEN];
+    }
+
+    /**
+     * @brief Guarda un correo con el siguiente ID (solo desde el escritor).
+     * @return Referencia estable al correo guardado.
+     */
+    const Correo& agregar(Correo c) {
+        size_t i = cantidad.load(memory_order_relaxed);
+        unique_ptr<Correo[]>& bloque = bloques[i / TAM_BLOQUE_ALMACEN];
+        if (!bloque) bloque.reset(new Correo[TAM_BLOQUE_ALMACEN]);
+        Correo& destino = bloque[i % TAM_BLOQUE_ALMACEN];
+        destino = move(c);
+        destino.id = (int)i + 1;
+        cantidad.store(i + 1, memory_order_release);
+        return destino;
+    }
+};
+
+AlmacenCorreos almacenCorreos;
+
+/// Bytes de cuerpos sin comprimir por bloque del almacén de cuerpos.
+const size_t TAM_BLOQUE_CUERPOS = 64 << 10;
+/// Bytes de los primeros cuerpos con los que se entrena el diccionario.
+const size_t TAM_MUESTRA_DICCIONARIO = 128 << 10;
+/// Muestra mínima para entrenar el diccionario al escribir un bloque antes
+/// de juntar TAM_MUESTRA_DICCIONARIO.
+const size_t MIN_MUESTRA_DICCIONARIO = 4 << 10;
+/// Tamaño máximo del diccionario de los bloques de cuerpos.
+const size_t TAM_DICCIONARIO_CUERPOS = 16 << 10;
+/// Bytes de bloques descomprimidos que guarda la caché del almacén de cuerpos.
+const size_t CAPACIDAD_CACHE_CUERPOS = 4 << 20;
+
+/*
+ * Compresión de los bloques de cuerpos: LZ77 con cadenas de hash sobre
+ * el diccionario seguido del bloque, de modo que las coincidencias pueden
+ * apuntar al diccionario. Un bloque comprimido es una sucesión de
+ *
+ *     varint literales, literales, varint m [, varint distancia]
+ *
+ * donde m = 0 termina el bloque y si no se copian m + MIN_COINCIDENCIA - 1
+ * bytes a `distancia` hacia atrás (pueden solaparse con lo que se copia).
+ * Los cuerpos repiten saludos, firmas y respuestas citadas, que dentro de
+ * un bloque se vuelven referencias cortas; el diccionario aporta lo que se
+ * repite entre bloques y sirve sobre todo a los bloques chicos, como los
+ * de un correo redactado a mano.
+ */
+
+/// Largo mínimo de una coincidencia.
+const size_t MIN_COINCIDENCIA = 4;
+/// Bits del índice de la tabla de hash del compresor.
+const int BITS_HASH_LZ = 15;
+/// Candidatos que se prueban por posición.
+const int MAX_CANDIDATOS_LZ = 16;
+
+void agregarVarint(string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out += (char)(v | 0x80);
+        v >>= 7;
+    }
+    out += (char)v;
+}
+
+/**
+ * @brief Lee un varint de `datos` en la posición `i` y la avanza.
+ * @return false si está truncado o no cabe en 64 bits.
+ */
+bool tomarVarint(string_view datos, size_t& i, uint64_t& v) {
+    v = 0;
+    for (int desplazamiento = 0; desplazamiento < 64 && i < datos.size(); desplazamiento += 7) {
+        uint8_t b = (uint8_t)datos[i++];
+        v |= (uint64_t)(b & 0x7F) << desplazamiento;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Comprime un bloque con el diccionario dado (puede ser vacío).
+ */
+string comprimirBloque(string_view diccionario, string_view datos) {
+    string entrada;
+    entrada.reserve(diccionario.size() + datos.size());
+    entrada.append(diccionario).append(datos);
+    size_t n = entrada.size();
+
+    vector<int> cabeza((size_t)1 << BITS_HASH_LZ, -1);
+    vector<int> previo(n, -1);
+    auto hash4 = [&](size_t i) {
+        uint32_t v;
+        memcpy(&v, entrada.data() + i, 4);
+        return (v * 2654435761u) >> (32 - BITS_HASH_LZ);
+    };
+    auto insertar = [&](size_t i) {
+        if (i + MIN_COINCIDENCIA > n) return;
+        uint32_t h = hash4(i);
+        previo[i] = cabeza[h];
+        cabeza[h] = (int)i;
+    };
+    for (size_t i = 0; i < diccionario.size(); i++) insertar(i);
+
+    string out;
+    size_t literales = diccionario.size();   // Inicio de los literales pendientes
+    size_t i = diccionario.size();
+    while (i + MIN_COINCIDENCIA <= n) {
+        size_t mejorLargo = 0, mejorInicio = 0;
+        int candidato = cabeza[hash4(i)];
+        for (int k = 0; k < MAX_CANDIDATOS_LZ && candidato >= 0; k++, candidato = previo[candidato]) {
+            size_t largo = 0;
+            while (i + largo < n && entrada[candidato + largo] == entrada[i + largo]) largo++;
+            if (largo > mejorLargo) {
+                mejorLargo = largo;
+                mejorInicio = (size_t)candidato;
+            }
+        }
+        if (mejorLargo < MIN_COINCIDENCIA) {
+            insertar(i++);
+            continue;
+        }
+        agregarVarint(out, i - literales);
+        out.append(entrada, literales, i - literales);
+        agregarVarint(out, mejorLargo - MIN_COINCIDENCIA + 1);
+        agregarVarint(out, i - mejorInicio);
+        for (size_t j = i; j < i + mejorLargo; j++) insertar(j);
+        i += mejorLargo;
+        literales = i;
+    }
+    agregarVarint(out, n - literales);
+    out.append(entrada, literales, n - literales);
+    agregarVarint(out, 0);
+    return out;
+}
+
+/**
+ * @brief Descomprime un bloque de `largoOriginal` bytes comprimido con el
+ *        mismo diccionario.
+ * @return false si los datos están dañados.
+ */
+bool descomprimirBloque(string_view diccionario, string_view comprimido, size_t largoOriginal,
+                        string& out) {
+    string salida;
+    salida.reserve(diccionario.size() + largoOriginal);
+    salida.append(diccionario);
+    size_t limite = diccionario.size() + largoOriginal;
+    size_t i = 0;
+    while (true) {
+        uint64_t literales, m, distancia;
+        if (!tomarVarint(comprimido, i, literales) || literales > comprimido.size() - i ||
+            literales > limite - salida.size())
+            return false;
+        salida.append(comprimido.substr(i, literales));
+        i += literales;
+        if (!tomarVarint(comprimido, i, m)) return false;
+        if (m == 0) break;
+        if (m > limite - salida.size() || !tomarVarint(comprimido, i, distancia) ||
+            distancia == 0 || distancia > salida.size())
+            return false;
+        size_t largo = m + MIN_COINCIDENCIA - 1;
+        if (largo > limite - salida.size()) return false;
+        size_t desde = salida.size() - distancia;
+        for (size_t k = 0; k < largo; k++) salida.push_back(salida[desde + k]);
+    }
+    if (i != comprimido.size() || salida.size() != limite) return false;
+    out.assign(salida, diccionario.size(), string::npos);
+    return true;
+}
+
+/**
+ * @brief Arma un diccionario de hasta `tamano` bytes con los trozos de la
+ *        muestra que más se repiten en ella.
+ *
+ * Cada trozo de 64 bytes vale la suma de las repeticiones de sus 8-gramas
+ * en toda la muestra. Se toman los de mayor valor, salvo los que en su
+ * mayoría repiten 8-gramas ya elegidos, y los mejores quedan al final del
+ * diccionario, donde las distancias al bloque son más cortas.
+ */
+string entrenarDiccionario(string_view muestra, size_t tamano) {
+    const size_t TROZO = 64, K = 8;
+    if (muestra.size() < K) return string();
+    auto grama = [&](size_t i) {
+        uint64_t v;
+        memcpy(&v, muestra.data() + i, K);
+        return v;
+    };
+    unordered_map<uint64_t, int> frecuencias;
+    for (size_t i = 0; i + K <= muestra.size(); i++) frecuencias[grama(i)]++;
+
+    vector<pair<long long, size_t>> trozos;   // (valor, inicio)
+    for (size_t ini = 0; ini + TROZO <= muestra.size(); ini += TROZO) {
+        long long valor = 0;
+        for (size_t i = ini; i + K <= ini + TROZO; i++) valor += frecuencias[grama(i)] - 1;
+        if (valor > 0) trozos.push_back({valor, ini});
+    }
+    sort(trozos.begin(), trozos.end(), greater<pair<long long, size_t>>());
+
+    unordered_set<uint64_t> cubiertos;
+    vector<size_t> elegidos;
+    for (auto [valor, ini] : trozos) {
+        if ((elegidos.size() + 1) * TROZO > tamano) break;
+        size_t nuevos = 0;
+        for (size_t i = ini; i + K <= ini + TROZO; i++) nuevos += !cubiertos.count(grama(i));
+        if (2 * nuevos < TROZO - K + 1) continue;
+        for (size_t i = ini; i + K <= ini + TROZO; i++) cubiertos.insert(grama(i));
+        elegidos.push_back(ini);
+    }
+    string diccionario;
+    for (auto it = elegidos.rbegin(); it != elegidos.rend(); ++it)
+        diccionario.append(muestra.substr(*it, TROZO));
+    return diccionario;
+}
+
+const char MAGIA_CUERPOS[8] = {'C', 'O', 'R', 'R', 'C', 'U', 'E', '\0'};
+const uint32_t VERSION_CUERPOS = 1;
+
+/// Tipos de registro del archivo de cuerpos.
+enum TipoRegistroCuerpos : uint32_t {
+    REGISTRO_DICCIONARIO = 1,   ///< El diccionario, sin comprimir
+    REGISTRO_BLOQUE = 2         ///< Un bloque de cuerpos comprimido
+};
+
+/**
+ * @struct CabeceraRegistroCuerpos
+ * @brief Cabecera de 24 bytes de cada registro del archivo de cuerpos.
+ */
+struct CabeceraRegistroCuerpos {
+    uint32_t tipo;
+    uint32_t conDiccionario;    ///< Bloques: 1 si se comprimió con el diccionario
+    uint64_t inicio;            ///< Bloques: posición de su primer byte entre los cuerpos
+    uint32_t largoOriginal;
+    uint32_t largoComprimido;   ///< Bytes que siguen a la cabecera
+};
+
+/**
+ * @class AlmacenCuerpos
+ * @brief Archivo de solo agregar con los cuerpos de los correos, para que
+ *        no ocupen memoria, comprimidos por bloques. Los listados solo
+ *        muestran remitente, asunto y fecha, así que un bloque se lee y se
+ *        descomprime cuando se abre uno de sus correos, y los descomprimidos
+ *        hace poco quedan en una caché LRU acotada en bytes.
+ *
+ * Si está activo, cada correo del almacén central guarda solo la posición
+ * de su cuerpo entre todos los cuerpos concatenados y su largo. El archivo
+ * empieza con magia y versión y sigue con registros: a lo sumo un
+ * diccionario, que se entrena con los primeros TAM_MUESTRA_DICCIONARIO
+ * bytes de cuerpos (o con los que haya, si son al menos
+ * MIN_MUESTRA_DICCIONARIO, al escribir el primer bloque), y bloques de unos TAM_BLOQUE_CUERPOS bytes sin
+ * comprimir que terminan en el límite de un cuerpo. Cada bloque indica su
+ * posición y si usa el diccionario, así que al abrir basta con leer las
+ * cabeceras.
+ *
+ * El escritor acumula los cuerpos en el bloque pendiente y lo escribe
+ * antes de guardar sus correos en el almacén central; leer no toma el
+ * candado mientras va al disco o descomprime. Los cuerpos de correos
+ * borrados quedan en el archivo hasta la próxima reconstrucción.
+ */
+class AlmacenCuerpos {
+private:
+    struct Bloque {
+        uint64_t inicio;            ///< Posición de su primer byte entre los cuerpos
+        uint64_t posicionArchivo;   ///< De los datos comprimidos
+        uint32_t largoOriginal;
+        uint32_t largoComprimido;
+        bool conDiccionario;
+    };
+
+    int fd = -1;
+    uint64_t tamanoArchivo = 0;   ///< Solo lo usa el escritor
+    uint64_t tamanoCuerpos = 0;   ///< Incluye el bloque pendiente (solo el escritor)
+    string pendiente;
+    string muestra;               ///< Cuerpos para entrenar el diccionario
+    bool entrenado = false;       ///< Ya hay diccionario o se intentó escribirlo
+    bool falloEscritura = false;  ///< Alguna escritura falló desde el último escribirPendiente()
+
+    // Protegidos por m. El diccionario no cambia después de asignarse, pero
+    // truncar() lo reemplaza: los lectores retienen el puntero que tomaron
+    mutable mutex m;
+    vector<Bloque> bloques;       ///< En orden de inicio
+    shared_ptr<const string> diccionario;   ///< nullptr = sin diccionario
+    mutable list<pair<size_t, shared_ptr<const string>>> recientes;   ///< El más reciente al frente
+    mutable unordered_map<size_t, decltype(recientes)::iterator> enCache;
+    mutable size_t bytesEnCache = 0;
+#ifdef _WIN32
+    mutable mutex mutexLectura;   ///< _lseeki64 y _read no son atómicos
+#endif
+
+    uint64_t tamanoEnDisco() const {
+#ifdef _WIN32
+        return (uint64_t)_lseeki64(fd, 0, SEEK_END);
+#else
+        struct stat st;
+        return fstat(fd, &st) == 0 ? (uint64_t)st.st_size : 0;
+#endif
+    }
+
+    bool recortarA(uint64_t largo) {
+#ifdef _WIN32
+        return _chsize_s(fd, (long long)largo) == 0;
+#else
+        return ftruncate(fd, (off_t)largo) == 0;
+#endif
+    }
+
+    bool escribirTodo(const string& datos) {
+        const char* p = datos.data();
+        size_t resto = datos.size();
+        while (resto > 0) {
+#ifdef _WIN32
+            int n = _write(fd, p, (unsigned)resto);
+#else
+            ssize_t n = write(fd, p, resto);
+#endif
+            if (n <= 0) return false;
+            p += n;
+            resto -= (size_t)n;
+        }
+        return true;
+    }
+
+    bool leerEn(uint64_t posicion, char* destino, size_t largo) const {
+#ifdef _WIN32
+        lock_guard<mutex> bloqueo(mutexLectura);
+        if (_lseeki64(fd, (long long)posicion, SEEK_SET) < 0) return false;
+#endif
+        while (largo > 0) {
+#ifdef _WIN32
+            int n = _read(fd, destino, (unsigned)largo);
+#else
+            ssize_t n = pread(fd, destino, largo, (off_t)posicion);
+#endif
+            if (n <= 0) return false;
+            destino += n;
+            posicion += (uint64_t)n;
+            largo -= (size_t)n;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Agrega un registro al final del archivo. Si la escritura falla
+     *        recorta lo que haya quedado, para no dejar un registro a medias.
+     * @return false si no se pudo escribir.
+     */
+    bool escribirRegistro(CabeceraRegistroCuerpos cab, string_view datos) {
+        string registro((const char*)&cab, sizeof cab);
+        registro.append(datos);
+        if (!escribirTodo(registro)) {
+            falloEscritura = true;
+            recortarA(tamanoArchivo);
+            return false;
+        }
+        tamanoArchivo += registro.size();
+        return true;
+    }
+
+    void entrenar() {
+        entrenado = true;
+        string nuevo = entrenarDiccionario(muestra, TAM_DICCIONARIO_CUERPOS);
+        muestra = string();
+        if (nuevo.empty()) return;
+        CabeceraRegistroCuerpos cab{REGISTRO_DICCIONARIO, 0, 0, (uint32_t)nuevo.size(),
+                                    (uint32_t)nuevo.size()};
+        if (!escribirRegistro(cab, nuevo)) return;
+        lock_guard<mutex> bloqueo(m);
+        diccionario = make_shared<const string>(move(nuevo));
+    }
+
+    shared_ptr<const string> diccionarioActual() const {
+        lock_guard<mutex> bloqueo(m);
+        return diccionario;
+    }
+
+    void escribirBloque() {
+        if (pendiente.empty()) return;
+        // Un archivo con pocos cuerpos nunca llena la muestra
+        if (!entrenado && muestra.size() >= MIN_MUESTRA_DICCIONARIO) entrenar();
+        shared_ptr<const string> dic = diccionarioActual();
+        bool conDiccionario = dic != nullptr;
+        string comprimido = comprimirBloque(conDiccionario ? *dic : "", pendiente);
+        Bloque b{tamanoCuerpos - pendiente.size(), tamanoArchivo + sizeof(CabeceraRegistroCuerpos),
+                 (uint32_t)pendiente.size(), (uint32_t)comprimido.size(), conDiccionario};
+        pendiente.clear();
+        CabeceraRegistroCuerpos cab{REGISTRO_BLOQUE, conDiccionario, b.inicio, b.largoOriginal,
+                                    b.largoComprimido};
+        if (!escribirRegistro(cab, comprimido)) return;
+        lock_guard<mutex> bloqueo(m);
+        bloques.push_back(b);
+    }
+
+    /**
+     * @brief Bloque descomprimido, desde la caché o leyéndolo del disco.
+     */
+    shared_ptr<const string> bloqueDescomprimido(size_t i, const Bloque& b) const {
+        shared_ptr<const string> dic;
+        {
+            lock_guard<mutex> bloqueo(m);
+            auto it = enCache.find(i);
+            if (it != enCache.end()) {
+                recientes.splice(recientes.begin(), recientes, it->second);
+                return it->second->second;
+            }
+            dic = diccionario;
+        }
+        if (b.conDiccionario && !dic) return nullptr;
+
+        string comprimido(b.largoComprimido, '\0');
+        auto datos = make_shared<string>();
+        if (!leerEn(b.posicionArchivo, comprimido.data(), comprimido.size()) ||
+            !descomprimirBloque(b.conDiccionario ? *dic : "", comprimido, b.largoOriginal, *datos))
+            return nullptr;
+        if (datos->size() > CAPACIDAD_CACHE_CUERPOS) return datos;
+
+        lock_guard<mutex> bloqueo(m);
+        if (enCache.count(i)) return datos;
+        recientes.emplace_front(i, datos);
+        enCache[i] = recientes.begin();
+        bytesEnCache += datos->size();
+        while (bytesEnCache > CAPACIDAD_CACHE_CUERPOS) {
+            bytesEnCache -= recientes.back().second->size();
+            enCache.erase(recientes.back().first);
+            recientes.pop_back();
+        }
+        return datos;
+    }
+
+    /**
+     * @brief Lee la magia y las cabeceras de los registros. Un registro
+     *        incompleto al final (por una escritura interrumpida) se recorta.
+     * @return false si el archivo no es un almacén de cuerpos.
+     */
+    bool leerRegistros() {
+        uint64_t tamano = tamanoEnDisco();
+        char magia[8];
+        uint32_t version;
+        if (tamano < sizeof magia + sizeof version || !leerEn(0, magia, sizeof magia) ||
+            !leerEn(sizeof magia, (char*)&version, sizeof version) ||
+            memcmp(magia, MAGIA_CUERPOS, sizeof magia) != 0 || version != VERSION_CUERPOS)
+            return false;
+
+        tamanoArchivo = sizeof magia + sizeof version;
+        CabeceraRegistroCuerpos cab;
+        while (tamano - tamanoArchivo >= sizeof cab &&
+               leerEn(tamanoArchivo, (char*)&cab, sizeof cab)) {
+            uint64_t datos = tamanoArchivo + sizeof cab;
+            if (tamano - datos < cab.largoComprimido) break;
+            if (cab.tipo == REGISTRO_DICCIONARIO) {
+                if (entrenado || cab.largoComprimido != cab.largoOriginal) return false;
+                string leido(cab.largoOriginal, '\0');
+                if (!leerEn(datos, leido.data(), leido.size())) return false;
+                diccionario = make_shared<const string>(move(leido));
+                entrenado = true;
+            } else if (cab.tipo == REGISTRO_BLOQUE) {
+                if (cab.inicio < tamanoCuerpos || (cab.conDiccionario && !diccionario))
+                    return false;
+                bloques.push_back({cab.inicio, datos, cab.largoOriginal, cab.largoComprimido,
+                                   cab.conDiccionario != 0});
+                tamanoCuerpos = cab.inicio + cab.largoOriginal;
+            } else {
+                return false;
+            }
+            tamanoArchivo = datos + cab.largoComprimido;
+        }
+        return tamanoArchivo == tamano || recortarA(tamanoArchivo);
+    }
+
+public:
+    AlmacenCuerpos() = default;
+    AlmacenCuerpos(const AlmacenCuerpos&) = delete;
+    AlmacenCuerpos& operator=(const AlmacenCuerpos&) = delete;
+
+    ~AlmacenCuerpos() { cerrar(); }
+
+    /**
+     * @brief Abre el archivo de cuerpos, creándolo si no existe. Si no es un
+     *        almacén de cuerpos válido se vacía. Debe llamarse antes de
+     *        cargar o crear correos.
+     * @return false si no se pudo abrir; los cuerpos quedan en memoria.
+     */
+    bool abrir(const string& nombreArchivo) {
+#ifdef _WIN32
+        fd = _open(nombreArchivo.c_str(), _O_RDWR | _O_APPEND | _O_CREAT | _O_BINARY,
+                   _S_IREAD | _S_IWRITE);
+#else
+        fd = open(nombreArchivo.c_str(), O_RDWR | O_APPEND | O_CREAT, 0644);
+#endif
+        if (fd < 0) return false;
+        if (leerRegistros()) return true;
+        if (truncar()) return true;
+        cerrar();
+        return false;
+    }
+
+    bool activo() const { return fd >= 0; }
+
+    /// Bytes de cuerpos guardados, contando el bloque pendiente.
+    uint64_t tamano() const { return tamanoCuerpos; }
+
+    /**
+     * @brief Descarta todos los cuerpos y el diccionario; se usa al
+     *        reconstruir los índices, cuando ningún correo los referencia.
+     */
+    bool truncar() {
+        pendiente.clear();
+        muestra.clear();
+        entrenado = false;
+        tamanoCuerpos = 0;
+        {
+            lock_guard<mutex> bloqueo(m);
+            bloques.clear();
+            diccionario = nullptr;
+            recientes.clear();
+            enCache.clear();
+            bytesEnCache = 0;
+        }
+        string inicio(MAGIA_CUERPOS, sizeof MAGIA_CUERPOS);
+        inicio.append((const char*)&VERSION_CUERPOS, sizeof VERSION_CUERPOS);
+        bool ok = recortarA(0) && escribirTodo(inicio);
+        tamanoArchivo = tamanoEnDisco();
+        return ok;
+    }
+
+    /**
+     * @brief Agrega un cuerpo al bloque pendiente (solo desde el escritor).
+     * @return Posición que tendrá entre los cuerpos.
+     */
+    uint64_t agregar(string_view cuerpo) {
+        if (!pendiente.empty() && pendiente.size() + cuerpo.size() > TAM_BLOQUE_CUERPOS)
+            escribirBloque();
+        if (!entrenado) {
+            muestra.append(cuerpo.substr(0, TAM_MUESTRA_DICCIONARIO - muestra.size()));
+            if (muestra.size() == TAM_MUESTRA_DICCIONARIO) entrenar();
+        }
+        uint64_t posicion = tamanoCuerpos;
+        pendiente += cuerpo;
+        tamanoCuerpos += cuerpo.size();
+        if (pendiente.size() >= TAM_BLOQUE_CUERPOS) escribirBloque();
+        return posicion;
+    }
+
+    /**
+     * @brief Comprime y escribe el bloque pendiente, sin esperar al disco.
+     *        Debe llamarse antes de que algún correo del bloque sea visible.
+     * @return false si alguna escritura falló desde la llamada anterior; las
+     *         posiciones devueltas por agregar() desde entonces no son
+     *         válidas.
+     */
+    bool escribirPendiente() {
+        escribirBloque();
+        bool ok = !falloEscritura;
+        falloEscritura = false;
+        return ok;
+    }
+
+    /**
+     * @brief Espera a que los cuerpos escritos lleguen al disco (antes de
+     *        guardar una instantánea que los referencia).
+     */
+    bool sincronizar() {
+        if (fd < 0) return true;
+#ifdef _WIN32
+        return _commit(fd) == 0;
+#else
+        return fsync(fd) == 0;
+#endif
+    }
+
+    /**
+     * @brief Cuerpo de un correo que está en el archivo. Descomprime a lo
+     *        sumo su bloque. Es seguro llamarla desde varios hilos.
+     * @return El cuerpo, o nullptr si no se pudo leer.
+     */
+    shared_ptr<const string> leer(const Correo& c) const {
+        size_t i;
+        Bloque b;
+        {
+            lock_guard<mutex> bloqueo(m);
+            auto it = upper_bound(bloques.begin(), bloques.end(), c.posicionCuerpo,
+                                  [](uint64_t p, const Bloque& x) { return p < x.inicio; });
+            if (it == bloques.begin()) return nullptr;
+            --it;
+            i = (size_t)(it - bloques.begin());
+            b = *it;
+        }
+        if (c.posicionCuerpo + c.largoCuerpo > b.inicio + b.largoOriginal) return nullptr;
+        shared_ptr<const string> datos = bloqueDescomprimido(i, b);
+        if (!datos) return nullptr;
+        return make_shared<string>(*datos, (size_t)(c.posicionCuerpo - b.inicio), c.largoCuerpo);
+    }
+
+    void cerrar() {
+        if (fd < 0) return;
+        escribirBloque();
+#ifdef _WIN32
+        _close(fd);
+#else
+        close(fd);
+#endif
+        fd = -1;
+    }
+};
+
+AlmacenCuerpos almacenCuerpos;
+
+/**
+ * @brief Cuerpo de un correo, esté en memoria o en el almacén de cuerpos.
+ *        Si no se puede leer del disco devuelve una cadena vacía.
+ */
+string cuerpoDe(const Correo& c) {
+    if (c.largoCuerpo == 0) return c.cuerpo;
+    shared_ptr<const string> cuerpo = almacenCuerpos.leer(c);
+    return cuerpo ? *cuerpo : string();
+}
+
+/// Cantidad de postings por bloque comprimido.
+const size_t TAM_BLOQUE_POSTINGS = 128;
+
+/**
+ * @class ListaPostings
+ * @brief Postings de un término: IDs en orden creciente y la frecuencia del
+ *        término en cada correo, comprimidos por bloques.
+ *
+ * Cada bloque de TAM_BLOQUE_POSTINGS postings guarda, por posting, dos
+ * varints: la diferencia con el ID anterior y la frecuencia. Un posting
+ * típico ocupa así 2 o 3 bytes en lugar de 8. Por cada bloque hay un salto
+ * con su último ID y su posición en los datos, de modo que las búsquedas
+ * descartan bloques completos sin decodificarlos y solo descomprimen los
+ * bloques que visitan. El último bloque, incompleto, queda sin comprimir
+ * para poder agregar al final.
+ */
+class ListaPostings {
+private:
+    struct Salto {
+        int ultimoId;              ///< Mayor ID del bloque
+        uint32_t desplazamiento;   ///< Inicio del bloque en `datos`
+    };
+
+    vector<uint8_t> datos;
+    vector<Salto> saltos;
+    vector<int> colaIds;
+    vector<int> colaFrecuencias;
+    int frecuenciaMaxima = 0;
+
+    static void escribirVarint(vector<uint8_t>& out, uint32_t v) {
+        while (v >= 0x80) {
+            out.push_back((uint8_t)(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back((uint8_t)v);
+    }
+
+    /**
+     * @brief Lee un varint sin pasar de `fin`.
+     * @return false si el varint está truncado o no cabe en 32 bits.
+     */
+    static bool leerVarint(const uint8_t*& p, const uint8_t* fin, uint32_t& v) {
+        v = 0;
+        for (int desp = 0; desp < 35 && p < fin; desp += 7) {
+            uint8_t b = *p++;
+            v |= (uint32_t)(b & 0x7F) << desp;
+            if (b < 0x80) return true;
+        }
+        return false;
+    }
+
+    /// ID previo al primero del bloque `b` (las diferencias parten de él).
+    int idBase(size_t b) const { return b ? saltos[b - 1].ultimoId : 0; }
+
+    /**
+     * @brief Comprime la cola como un bloque nuevo.
+     */
+    void cerrarBloque() {
+        uint32_t inicio = (uint32_t)datos.size();
+        int anterior = idBase(saltos.size());
+        for (size_t i = 0; i < colaIds.size(); i++) {
+            escribirVarint(datos, (uint32_t)(colaIds[i] - anterior));
+            escribirVarint(datos, (uint32_t)colaFrecuencias[i]);
+            anterior = colaIds[i];
+        }
+        saltos.push_back({anterior, inicio});
+        colaIds.clear();
+        colaFrecuencias.clear();
+    }
+
+    /**
+     * @brief Descomprime el bloque cerrado `b`, de TAM_BLOQUE_POSTINGS
+     *        postings. Los datos ya fueron validados al armarse la lista.
+     */
+    void decodificarBloque(size_t b, int* ids, int* frecuencias) const {
+        const uint8_t* p = datos.data() + saltos[b].desplazamiento;
+        const uint8_t* fin = datos.data() + datos.size();
+        int id = idBase(b);
+        uint32_t v;
+        for (size_t i = 0; i < TAM_BLOQUE_POSTINGS; i++) {
+            leerVarint(p, fin, v);
+            id += (int)v;
+            ids[i] = id;
+            leerVarint(p, fin, v);
+            frecuencias[i] = (int)v;
+        }
+    }
+
+public:
+    /**
+     * @class Cursor
+     * @brief Recorrido de la lista que descomprime un bloque a la vez.
+     */
+    class Cursor {
+    private:
+        const ListaPostings* lista;
+        size_t bloque = 0;   ///< Bloque actual; saltos.size() es la cola
+        size_t pos = 0;
+        size_t cant = 0;     ///< Postings del bloque actual (0 = fin)
+        int ids[TAM_BLOQUE_POSTINGS];
+        int frecuencias[TAM_BLOQUE_POSTINGS];
+
+        void cargar(size_t b) {
+            bloque = b;
+            pos = 0;
+            size_t cerrados = lista->saltos.size();
+            if (b < cerrados) {
+                lista->decodificarBloque(b, ids, frecuencias);
+                cant = TAM_BLOQUE_POSTINGS;
+            } else if (b == cerrados) {
+                cant = lista->colaIds.size();
+                copy(lista->colaIds.begin(), lista->colaIds.end(), ids);
+                copy(lista->colaFrecuencias.begin(), lista->colaFrecuencias.end(), frecuencias);
+            } else {
+                cant = 0;
+            }
+        }
+
+    public:
+        explicit Cursor(const ListaPostings& l) : lista(&l) { cargar(0); }
+
+        bool fin() const { return pos >= cant; }
+
+        /// ID del posting actual (requiere !fin()).
+        int doc() const { return ids[pos]; }
+
+        /// Frecuencia del término en el correo actual (requiere !fin()).
+        int frecuencia() const { return frecuencias[pos]; }
+
+        void siguiente() {
+            if (++pos == cant) cargar(bloque + 1);
+        }
+
+        /**
+         * @brief Avanza hasta el primer ID >= id. Los bloques intermedios se
+         *        saltan con una búsqueda binaria en los saltos, sin
+         *        descomprimirlos.
+         */
+        void avanzarHasta(int id) {
+            if (fin()) return;
+            if (ids[cant - 1] < id) {
+                const vector<Salto>& s = lista->saltos;
+                size_t b = lower_bound(s.begin() + min(bloque + 1, s.size()), s.end(), id,
+                                       [](const Salto& x, int v) { return x.ultimoId < v; })
+                           - s.begin();
+                cargar(b);
+            }
+            pos = lower_bound(ids + pos, ids + cant, id) - ids;
+            if (pos == cant) cargar(bloque + 1);
+        }
+    };
+
+    void agregar(int id, int frecuencia) {
+        colaIds.push_back(id);
+        colaFrecuencias.push_back(frecuencia);
+        frecuenciaMaxima = max(frecuenciaMaxima, frecuencia);
+        if (colaIds.size() == TAM_BLOQUE_POSTINGS) cerrarBloque();
+    }
+
+    /// Cantidad de postings (frecuencia de documento del término).
+    size_t tamano() const { return saltos.size() * TAM_BLOQUE_POSTINGS + colaIds.size(); }
+
+    /// Bytes que ocupan los postings (sin la reserva libre de los vectores).
+    size_t bytes() const {
+        return datos.size() + saltos.size() * sizeof(Salto) +
+               colaIds.size() * (sizeof(int) + sizeof(int));
+    }
+
+    bool vacia() const { return tamano() == 0; }
+
+    /// Mayor ID de la lista (0 si está vacía).
+    int ultimoId() const {
+        if (!colaIds.empty()) return colaIds.back();
+        return saltos.empty() ? 0 : saltos.back().ultimoId;
+    }
+
+    /// Cota para la poda de MaxScore.
+    int maxFrecuencia() const { return frecuenciaMaxima; }
+
+    /**
+     * @brief Descomprime todos los IDs, en orden creciente.
+     */
+    vector<int> decodificarIds() const {
+        vector<int> out;
+        out.reserve(tamano());
+        for (Cursor c(*this); !c.fin(); c.siguiente()) out.push_back(c.doc());
+        return out;
+    }
+
+    /**
+     * @brief Agrega a `out` la lista como un único flujo de varints: los
+     *        bloques cerrados tal cual y la cola codificada de la misma forma.
+     */
+    void serializar(vector<uint8_t>& out) const {
+        out.insert(out.end(), datos.begin(), datos.end());
+        int anterior = idBase(saltos.size());
+        for (size_t i = 0; i < colaIds.size(); i++) {
+            escribirVarint(out, (uint32_t)(colaIds[i] - anterior));
+            escribirVarint(out, (uint32_t)colaFrecuencias[i]);
+            anterior = colaIds[i];
+        }
+    }
+
+    /**
+     * @brief Reemplaza la lista por `n` postings leídos de un flujo de
+     *        `serializar`, reconstruyendo los saltos y la cola.
+     * @return false si el flujo no contiene exactamente `n` postings con IDs
+     *         crecientes y frecuencias positivas.
+     */
+    bool cargar(const uint8_t* p, size_t nBytes, size_t n) {
+        *this = ListaPostings();
+        const uint8_t* inicio = p;
+        const uint8_t* fin = p + nBytes;
+        size_t enBloques = n - n % TAM_BLOQUE_POSTINGS;
+        size_t inicioBloque = 0;
+        int id = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (i % TAM_BLOQUE_POSTINGS == 0) inicioBloque = p - inicio;
+            uint32_t delta, frecuencia;
+            if (!leerVarint(p, fin, delta) || !leerVarint(p, fin, frecuencia) ||
+                delta == 0 || delta > (uint32_t)(INT_MAX - id) ||
+                frecuencia == 0 || frecuencia > INT_MAX)
+                return false;
+            id += (int)delta;
+            frecuenciaMaxima = max(frecuenciaMaxima, (int)frecuencia);
+            if (i < enBloques) {
+                if (i % TAM_BLOQUE_POSTINGS == TAM_BLOQUE_POSTINGS - 1)
+                    saltos.push_back({id, (uint32_t)inicioBloque});
+                if (i + 1 == enBloques) datos.assign(inicio, p);
+            } else {
+                colaIds.push_back(id);
+                colaFrecuencias.push_back((int)frecuencia);
+            }
+        }
+        return p == fin;
+    }
+};
+
+// ============================================================================
+// TOKENIZACIÓN Y ANÁLISIS DE TÉRMINOS
+// ============================================================================
+/**
+ * @brief Ruta rápida ASCII del tokenizador: para cada byte < 0x80, su
+ *        minúscula si es alfanumérico o 0 si separa palabras.
+ */
+const array<char, 128> MINUSCULA_ASCII = [] {
+    array<char, 128> t{};
+    for (int c = 0; c < 128; c++) {
+        if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z')) t[c] = (char)c;
+        else if (c >= 'A' && c <= 'Z') t[c] = (char)(c - 'A' + 'a');
+    }
+    return t;
+}();
+
+/**
+ * @brief Plegado de las letras U+00C0..U+00DF (y de sus minúsculas, 0x20
+ *        más adelante): sin tilde ni diéresis y en minúsculas. La ñ se
+ *        conserva porque distingue palabras ("año", "ano"); nullptr marca
+ *        los signos × y ÷, que separan palabras.
+ */
+const char* const PLEGADO_LATIN1[32] = {
+    "a", "a", "a", "a", "a", "a", "ae", "c", "e", "e", "e", "e", "i", "i", "i", "i",
+    "d", "\xC3\xB1", "o", "o", "o", "o", "o", nullptr, "o", "u", "u", "u", "u", "y", "th", "ss"
+};
+
+/**
+ * @brief Decodifica el carácter UTF-8 que empieza en texto[i] y deja en
+ *        `largo` cuántos bytes ocupa. Un byte que no inicia una secuencia
+ *        válida se toma como un carácter Latin-1, de modo que los archivos
+ *        en esa codificación también se tokenizan bien.
+ */
+uint32_t decodificarUtf8(string_view texto, size_t i, size_t& largo) {
+    const unsigned char* p = (const unsigned char*)texto.data() + i;
+    size_t resto = texto.size() - i;
+    uint32_t cp = p[0];
+    largo = 1;
+    size_t extra = (cp >= 0xC2 && cp < 0xE0) ? 1
+                 : (cp >= 0xE0 && cp < 0xF0) ? 2
+                 : (cp >= 0xF0 && cp < 0xF5) ? 3 : 0;
+    if (extra == 0 || extra >= resto) return cp;
+    uint32_t v = cp & (0x3F >> extra);
+    for (size_t k = 1; k <= extra; k++) {
+        if ((p[k] & 0xC0) != 0x80) return cp;
+        v = (v << 6) | (p[k] & 0x3F);
+    }
+    if ((extra == 2 && v < 0x800) || (extra == 3 && (v < 0x10000 || v > 0x10FFFF)) ||
+        (v >= 0xD800 && v <= 0xDFFF))
+        return cp;
+    largo = extra + 1;
+    return v;
+}
+
+/**
+ * @brief Forma plegada de un carácter no ASCII dentro de un término. Las
+ *        letras latinas pierden tildes y mayúsculas; los demás caracteres
+ *        de escritura se conservan tal cual (`original`).
+ * @return false si el carácter separa palabras (puntuación, espacios).
+ */
+bool plegarCaracter(uint32_t cp, string_view original, string_view& plegado) {
+    if (cp < 0xC0) return false;   // controles C1 y signos Latin-1 (¿, ¡, «, », ...)
+    if (cp <= 0xFF) {
+        if (cp == 0xFF) {
+            plegado = "y";
+            return true;
+        }
+        const char* p = PLEGADO_LATIN1[(cp - 0xC0) & 0x1F];
+        if (!p) return false;
+        plegado = p;
+        return true;
+    }
+    if ((cp >= 0x2000 && cp <= 0x206F) ||   // puntuación general
+        (cp >= 0x2100 && cp <= 0x2BFF) ||   // flechas, símbolos matemáticos y técnicos
+        (cp >= 0x3000 && cp <= 0x303F) ||   // puntuación CJK
+        (cp >= 0xFE00 && cp <= 0xFE0F) ||   // selectores de variante
+        (cp >= 0x1F000 && cp <= 0x1FAFF) || // emojis y pictogramas
+        cp == 0xFEFF)
+        return false;
+    plegado = original;
+    return true;
+}
+
+/**
+ * @class EtapaAnalisis
+ * @brief Etapa del análisis entre la tokenización y la indexación. Recibe
+ *        cada término ya plegado y puede modificarlo en su lugar o
+ *        descartarlo. Las etapas no guardan estado por término, así que un
+ *        mismo analizador puede usarse desde varios hilos.
+ */
+class EtapaAnalisis {
+public:
+    virtual ~EtapaAnalisis() = default;
+
+    /**
+     * @return false si el término debe descartarse.
+     */
+    virtual bool procesar(string& termino) const = 0;
+
+    /**
+     * @brief Texto que identifica la etapa y su configuración; entra en la
+     *        firma del analizador.
+     */
+    virtual string descripcion() const = 0;
+};
+
+/**
+ * @class FiltroPalabrasVacias
+ * @brief Descarta las palabras vacías (artículos, preposiciones, ...), cuyas
+ *        listas de postings cubren casi todos los correos sin aportar al
+ *        ranking.
+ */
+class FiltroPalabrasVacias : public EtapaAnalisis {
+private:
+    unordered_set<string> vacias;
+    size_t largoMaximo = 0;   ///< Los términos más largos no se buscan
+
+public:
+    explicit FiltroPalabrasVacias(const vector<string>& palabras)
+        : vacias(palabras.begin(), palabras.end()) {
+        for (const string& p : palabras) largoMaximo = max(largoMaximo, p.size());
+    }
+
+    bool procesar(string& termino) const override {
+        return termino.size() > largoMaximo || !vacias.count(termino);
+    }
+
+    string descripcion() const override {
+        vector<string> orden(vacias.begin(), vacias.end());
+        sort(orden.begin(), orden.end());
+        string d = "vacias:";
+        for (const string& p : orden) d += p + ',';
+        return d;
+    }
+};
+
+/// Palabras vacías del español, ya plegadas como las deja el tokenizador.
+const vector<string> PALABRAS_VACIAS_ES = {
+    "a", "al", "algo", "ante", "antes", "como", "con", "contra", "cual", "cuando", "de",
+    "del", "desde", "donde", "durante", "e", "el", "ella", "ellos", "en", "entre", "era",
+    "es", "esa", "ese", "eso", "esta", "estas", "este", "esto", "estos", "fue", "ha",
+    "hay", "la", "las", "le", "les", "lo", "los", "mas", "me", "mi", "muy", "ni", "no",
+    "nos", "o", "otra", "otro", "para", "pero", "por", "porque", "que", "quien", "se",
+    "ser", "si", "sin", "sobre", "son", "su", "sus", "tambien", "te", "tu", "u", "un",
+    "una", "uno", "unos", "y", "ya", "yo"
+};
+
+/**
+ * @class LematizadorLigero
+ * @brief Lematizador ligero del español: quita plurales y género
+ *        ("notas" -> "nota", "parciales" -> "parcial"), terminaciones de
+ *        infinitivo, participio y gerundio ("entregar", "entregado",
+ *        "entregando" -> "entreg"). Es deliberadamente conservador: no
+ *        toca términos de menos de 5 letras y, salvo en los plurales en
+ *        "-ces" y "-eses", no deja raíces de menos de 4.
+ *
+ * "-ces" vuelve a "-z" solo tras una vocal ("veces" -> "vez", "luces" ->
+ * "luz", "narices" -> "nariz"); tras una consonante el singular termina en
+ * "-ce" y ambos quedan en la misma raíz ("dulces", "dulce" -> "dulc").
+ */
+class LematizadorLigero : public EtapaAnalisis {
+private:
+    static bool terminaEn(const string& t, const char* sufijo) {
+        size_t n = strlen(sufijo);
+        return t.size() >= n && t.compare(t.size() - n, n, sufijo) == 0;
+    }
+
+    static bool quitar(string& t, const char* sufijo) {
+        size_t n = strlen(sufijo);
+        if (t.size() < n + 4 || !terminaEn(t, sufijo)) return false;
+        t.resize(t.size() - n);
+        return true;
+    }
+
+public:
+    bool procesar(string& t) const override {
+        if (t.size() < 5) return true;
+        for (const char* sufijo : {"iendo", "ando", "ados", "adas", "idos", "idas",
+                                   "ado", "ada", "ido", "ida"})
+            if (quitar(t, sufijo)) return true;
+        if (terminaEn(t, "eses")) {   // "meses" -> "mes"
+            t.resize(t.size() - 2);
+            return true;
+        }
+        if (terminaEn(t, "ces") && strchr("aeiou", t[t.size() - 4])) {   // "veces" -> "vez"
+            t.resize(t.size() - 2);
+            t.back() = 'z';
+            return true;
+        }
+        for (const char* sufijo : {"os", "as", "es", "ar", "er", "ir", "o", "a", "e", "s"})
+            if (quitar(t, sufijo)) return true;
+        return true;
+    }
+
+    string descripcion() const override { return "lematizador-ligero-2"; }
+};
+
+/**
+ * @class Analizador
+ * @brief Cadena configurable de etapas que se aplica a cada término, tanto
+ *        al indexar como al consultar.
+ */
+class Analizador {
+private:
+    vector<unique_ptr<EtapaAnalisis>> etapas;
+
+public:
+    void agregar(unique_ptr<EtapaAnalisis> etapa) { etapas.push_back(move(etapa)); }
+
+    void limpiar() { etapas.clear(); }
+
+    /**
+     * @return false si alguna etapa descartó el término.
+     */
+    bool procesar(string& termino) const {
+        for (const auto& etapa : etapas)
+            if (!etapa->procesar(termino)) return false;
+        return !termino.empty();
+    }
+
+    /**
+     * @brief Firma (FNV-1a) de las etapas y su configuración. La instantánea
+     *        la guarda para no reutilizar índices armados con otro análisis.
+     */
+    uint32_t firma() const {
+        uint32_t h = 2166136261u;
+        for (const auto& etapa : etapas)
+            for (char ch : etapa->descripcion() + ';') h = (h ^ (unsigned char)ch) * 16777619u;
+        return h;
+    }
+};
+
+/**
+ * @brief Analizador de los términos indexados: palabras vacías del español
+ *        seguidas del lematizador ligero.
+ */
+Analizador analizadorTerminos = [] {
+    Analizador a;
+    a.agregar(make_unique<FiltroPalabrasVacias>(PALABRAS_VACIAS_ES));
+    a.agregar(make_unique<LematizadorLigero>());
+    return a;
+}();
+
+/**
+ * @class Tokenizador
+ * @brief Separa textos en términos sin reservar memoria por token.
+ *
+ * Trabaja sobre vistas del texto original, que se interpreta como UTF-8:
+ * cada término es una secuencia de letras y dígitos que se copia plegada
+ * (minúsculas y sin tildes: "Cálculo" -> "calculo") a un buffer
+ * reutilizado. Los tramos ASCII, que son la mayoría, se resuelven con una
+ * tabla; solo los bytes >= 0x80 pasan por el decodificador. Al
+ * contar los términos de un correo, cada término pasa por el analizador y
+ * las frecuencias se acumulan en un vector indexado por ID de término que
+ * se limpia solo en las posiciones usadas. Cada hilo debe usar su propio
+ * tokenizador.
+ */
+class Tokenizador {
+private:
+    const Analizador* analizador;
+    string palabra;                  ///< Término actual, en minúsculas
+    vector<int> conteo;              ///< Frecuencia por ID (0 fuera del correo actual)
+    vector<pair<int, int>> filaActual;   ///< (ID, frecuencia) del último correo
+
+public:
+    explicit Tokenizador(const Analizador& a = analizadorTerminos) : analizador(&a) {}
+
+    /**
+     * @brief Llama a `emitir(termino)` por cada término de `texto`, antes
+     *        del análisis. Es la regla de tokenización tanto al indexar como
+     *        al consultar; el término es el buffer interno y solo es válido
+     *        durante la llamada (puede modificarse).
+     */
+    template <class F>
+    void separar(string_view texto, F emitir) {
+        const unsigned char* p = (const unsigned char*)texto.data();
+        size_t i = 0, n = texto.size();
+        palabra.clear();
+        auto cerrar = [&]() {
+            if (palabra.empty()) return;
+            emitir(palabra);
+            palabra.clear();
+        };
+        while (i < n) {
+            // Tramo de letras y dígitos ASCII, copiado de una vez
+            size_t ini = i;
+            while (i < n && p[i] < 0x80 && MINUSCULA_ASCII[p[i]]) i++;
+            if (i > ini) {
+                size_t base = palabra.size();
+                palabra.append(texto.data() + ini, i - ini);
+                for (size_t k = base; k < palabra.size(); k++)
+                    palabra[k] = MINUSCULA_ASCII[(unsigned char)palabra[k]];
+                continue;
+            }
+            if (p[i] < 0x80) {
+                cerrar();
+                i++;
+                continue;
+            }
+            size_t largo;
+            uint32_t cp = decodificarUtf8(texto, i, largo);
+            string_view plegado;
+            if (plegarCaracter(cp, texto.substr(i, largo), plegado))
+                palabra.append(plegado.data(), plegado.size());
+            else
+                cerrar();
+            i += largo;
+        }
+        cerrar();
+    }
+
+private:
+    template <class Internar>
+    int contarTextos(initializer_list<string_view> textos, Internar internar) {
+        filaActual.clear();
+        int longitud = 0;
+        auto registrar = [&](string& termino) {
+            if (!analizador->procesar(termino)) return;
+            size_t id = (size_t)internar(termino);
+            if (id >= conteo.size()) conteo.resize(max(id + 1, 2 * conteo.size()), 0);
+            if (conteo[id]++ == 0) filaActual.push_back({(int)id, 0});
+            longitud++;
+        };
+        for (string_view t : textos) separar(t, registrar);
+        for (auto& [id, frecuencia] : filaActual) {
+            frecuencia = conteo[id];
+            conteo[id] = 0;
+        }
+        return longitud;
+    }
+
+public:
+    /**
+     * @brief Cuenta los términos analizados del asunto y el cuerpo.
+     *        `internar(termino)` debe devolver el ID del término; el resultado
+     *        queda en fila().
+     * @return Longitud del correo en términos (sin los descartados).
+     */
+    template <class Internar>
+    int contar(string_view asunto, string_view cuerpo, Internar internar) {
+        return contarTextos({asunto, cuerpo}, internar);
+    }
+
+    /**
+     * @brief Como contar(), pero con los términos de un solo campo.
+     */
+    template <class Internar>
+    int contarCampo(string_view texto, Internar internar) {
+        return contarTextos({texto}, internar);
+    }
+
+    /**
+     * @brief Fila de la matriz dispersa del último correo contado: un par
+     *        (ID de término, frecuencia) por término distinto, en orden de
+     *        primera aparición.
+     */
+    const vector<pair<int, int>>& fila() const { return filaActual; }
+};
+
+/// Tokenizador de los correos creados en el hilo principal.
+Tokenizador tokenizador;
+
+// ============================================================================
+// ESTADÍSTICAS DE OPERACIONES
+// ============================================================================
+/*
+ * Con --estadisticas (y siempre en --benchmark) se mide la latencia de las
+ * operaciones principales en histogramas. Sin la opción cada medición se
+ * reduce a leer una bandera, y no se toma la hora.
+ *
+ * Las asignaciones de memoria se cuentan solo al compilar con
+ * -DBUSCADOR_CONTAR_ASIGNACIONES, que reemplaza el operator new global:
+ * un programa que enlace este archivo no debe heredar ese reemplazo sin
+ * pedirlo. Sin la opción los informes muestran las asignaciones como n/a.
+ */
+
+/// Si se miden las operaciones.
+atomic<bool> estadisticasActivas{false};
+atomic<uint64_t> asignaciones{0};
+atomic<uint64_t> bytesAsignados{0};
+
+#ifdef BUSCADOR_CONTAR_ASIGNACIONES
+/// Si `asignaciones` y `bytesAsignados` se cuentan en esta compilación.
+const bool CONTAR_ASIGNACIONES = true;
+
+// Las funciones de reemplazo no se dejan expandir en línea: el compilador
+// vería free() sobre punteros de new y avisaría de una falsa discordancia
+#ifdef _MSC_VER
+#define SIN_EN_LINEA __declspec(noinline)
+#else
+#define SIN_EN_LINEA __attribute__((noinline))
+#endif
+
+SIN_EN_LINEA void* operator new(size_t n) {
+    if (estadisticasActivas.load(memory_order_relaxed)) {
+        asignaciones.fetch_add(1, memory_order_relaxed);
+        bytesAsignados.fetch_add(n, memory_order_relaxed);
+    }
+    void* p = malloc(n ? n : 1);
+    if (!p) throw bad_alloc();
+    return p;
+}
+
+SIN_EN_LINEA void operator delete(void* p) noexcept { free(p); }
+SIN_EN_LINEA void operator delete(void* p, size_t) noexcept { free(p); }
+#else
+const bool CONTAR_ASIGNACIONES = false;
+#endif
+
+/**
+ * @class HistogramaLatencia
+ * @brief Histograma de duraciones en nanosegundos, seguro entre hilos.
+ *
+ * Cada potencia de dos se divide en cuatro cubetas, así que un percentil
+ * se informa con un error de a lo sumo un 25%.
+ */
+class HistogramaLatencia {
+private:
+    static const size_t CUBETAS = 256;
+    array<atomic<uint64_t>, CUBETAS> cubetas{};
+    atomic<uint64_t> cantidad{0}, sumaNs{0}, maximoNs{0};
+
+    static int bitMasAlto(uint64_t v) {
+        int b = 0;
+        while (v >>= 1) b++;
+        return b;
+    }
+
+    static size_t cubetaDe(uint64_t ns) {
+        if (ns < 4) return (size_t)ns;
+        int e = bitMasAlto(ns);
+        return min(CUBETAS - 1, (size_t)(e - 1) * 4 + (size_t)((ns >> (e - 2)) & 3));
+    }
+
+    /// Menor duración que cae en la cubeta i.
+    static uint64_t inicioCubeta(size_t i) {
+        if (i < 4) return i;
+        return (uint64_t)(4 + i % 4) << (i / 4 - 1);
+    }
+
+public:
+    void registrar(uint64_t ns) {
+        cubetas[cubetaDe(ns)].fetch_add(1, memory_order_relaxed);
+        cantidad.fetch_add(1, memory_order_relaxed);
+        sumaNs.fetch_add(ns, memory_order_relaxed);
+        uint64_t maximo = maximoNs.load(memory_order_relaxed);
+        while (ns > maximo && !maximoNs.compare_exchange_weak(maximo, ns, memory_order_relaxed)) {}
+    }
+
+    uint64_t muestras() const { return cantidad.load(memory_order_relaxed); }
+    uint64_t maximo() const { return maximoNs.load(memory_order_relaxed); }
+
+    uint64_t media() const {
+        uint64_t n = muestras();
+        return n ? sumaNs.load(memory_order_relaxed) / n : 0;
+    }
+
+    /**
+     * @brief Cota superior de la duración bajo la que queda la fracción `p`
+     *        de las muestras (p en [0, 1]).
+     */
+    uint64_t percentil(double p) const {
+        uint64_t n = muestras();
+        if (n == 0) return 0;
+        uint64_t objetivo = max<uint64_t>(1, (uint64_t)ceil(p * (double)n)), vistos = 0;
+        for (size_t i = 0; i < CUBETAS; i++) {
+            vistos += cubetas[i].load(memory_order_relaxed);
+            if (vistos >= objetivo) return min(maximo(), inicioCubeta(i + 1) - 1);
+        }
+        return maximo();
+    }
+};
+
+/// Operaciones que se miden.
+enum Operacion {
+    OP_CARGA,       ///< cargarCorreosDesdeArchivo, por archivo
+    OP_CREAR,       ///< crearCorreo, con la tokenización
+    OP_BORRAR,
+    OP_BUSCAR,      ///< MotorBusqueda::buscar, con la caché de consultas
+    OP_REMITENTE,   ///< MotorBusqueda::porRemitente, con la caché de consultas
+    OP_HTTP,        ///< Una petición del servidor, desde que está completa
+    NUM_OPERACIONES
+};
+
+const char* const NOMBRES_OPERACIONES[NUM_OPERACIONES] = {"carga",    "crear",     "borrar",
+                                                          "buscar",   "remitente", "http"};
+
+HistogramaLatencia latencias[NUM_OPERACIONES];
+
+/**
+ * @class MedirLatencia
+ * @brief Registra en el histograma de una operación lo que dura su ámbito.
+ */
+class MedirLatencia {
+private:
+    HistogramaLatencia* histograma;
+    chrono::steady_clock::time_point inicio;
+
+public:
+    explicit MedirLatencia(Operacion op)
+        : histograma(estadisticasActivas.load(memory_order_relaxed) ? &latencias[op] : nullptr) {
+        if (histograma) inicio = chrono::steady_clock::now();
+    }
+
+    MedirLatencia(const MedirLatencia&) = delete;
+    MedirLatencia& operator=(const MedirLatencia&) = delete;
+
+    ~MedirLatencia() {
+        if (!histograma) return;
+        auto ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - inicio);
+        histograma->registrar((uint64_t)ns.count());
+    }
+};
+
+/**
+ * @brief Duración legible: "850ns", "12.3us", "4.56ms", "1.20s".
+ */
+string textoDuracion(uint64_t ns) {
+    char texto[32];
+    if (ns < 1000) snprintf(texto, sizeof texto, "%lluns", (unsigned long long)ns);
+    else if (ns < 1000000) snprintf(texto, sizeof texto, "%.1fus", ns / 1e3);
+    else if (ns < 1000000000) snprintf(texto, sizeof texto, "%.2fms", ns / 1e6);
+    else snprintf(texto, sizeof texto, "%.2fs", ns / 1e9);
+    return texto;
+}
+
+/**
+ * @brief Fila de una tabla de latencias: nombre, muestras, media, p50, p99
+ *        y máximo.
+ */
+string filaLatencia(const string& nombre, const HistogramaLatencia& h) {
+    char fila[160];
+    snprintf(fila, sizeof fila, "  %-22s %10llu %10s %10s %10s %10s\n", nombre.c_str(),
+             (unsigned long long)h.muestras(), textoDuracion(h.media()).c_str(),
+             textoDuracion(h.percentil(0.5)).c_str(), textoDuracion(h.percentil(0.99)).c_str(),
+             textoDuracion(h.maximo()).c_str());
+    return fila;
+}
+
+string encabezadoLatencias() {
+    char fila[160];
+    snprintf(fila, sizeof fila, "  %-22s %10s %10s %10s %10s %10s\n", "operacion", "muestras",
+             "media", "p50", "p99", "max");
+    return fila;
+}
+
+// ============================================================================
+// SEGMENTOS DEL ÍNDICE Y VISTAS PUBLICADAS
+// ============================================================================
+/*
+ * Los índices se reparten en segmentos, cada uno dueño de un tramo contiguo
+ * de IDs. Un único escritor (serializado por mutexEscritor) llena el
+ * segmento abierto, que ningún lector ve. Al publicarlo se sella: pasa a
+ * ser inmutable y se arma una vista nueva con la lista de segmentos, que
+ * reemplaza a la anterior con un intercambio atómico de shared_ptr (RCU).
+ *
+ * Cada consulta toma la vista vigente al empezar y trabaja sobre ella sin
+ * candados: los segmentos que ve no cambian, y siguen vivos aunque se
+ * publique otra vista mientras tanto, porque la consulta retiene su
+ * shared_ptr. La vista vieja se libera cuando la suelta el último lector.
+ *
+ * Como en un árbol LSM, los segmentos se agrupan por nivel según su
+ * tamaño y, cuando se juntan FACTOR_FUSION segmentos contiguos del mismo
+ * nivel, un hilo en segundo plano los fusiona en uno del nivel siguiente.
+ * Indexar un correo cuesta lo mismo sin importar el tamaño del archivo, y
+ * una vista tiene a lo sumo unos pocos segmentos por nivel.
+ */
+
+/**
+ * @brief Quita espacios, tabuladores y retornos de carro de los extremos.
+ */
+string_view recortar(string_view s) {
+    const char* blancos = " \t\r";
+    size_t ini = s.find_first_not_of(blancos);
+    if (ini == string_view::npos) return string_view();
+    size_t fin = s.find_last_not_of(blancos);
+    return s.substr(ini, fin - ini + 1);
+}
+
+/**
+ * @brief Normaliza una dirección de remitente: quita espacios en los
+ *        extremos y la pasa a minúsculas.
+ */
+string normalizarRemitente(string_view rem) {
+    string normal(recortar(rem));
+    for (char &ch : normal) ch = tolower((unsigned char)ch);
+    return normal;
+}
+
+/**
+ * @brief Posición del bit encendido más bajo de `w`, que no debe ser 0.
+ */
+inline int ctz64(uint64_t w) {
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward64(&i, w);
+    return (int)i;
+#else
+    return __builtin_ctzll(w);
+#endif
+}
+
+/**
+ * @class MapaBorrados
+ * @brief Conjunto de IDs borrados dentro del tramo de un segmento, como
+ *        mapa de bits. Una vez publicado no se modifica: borrar otro correo
+ *        arma una copia con un bit más.
+ */
+class MapaBorrados {
+private:
+    int primerId;
+    vector<uint64_t> bits;
+    int cantidad = 0;
+
+public:
+    MapaBorrados(int primerId, int n) : primerId(primerId), bits(((size_t)n + 63) / 64, 0) {}
+
+    bool contiene(int id) const {
+        size_t i = (size_t)(id - primerId);
+        return i / 64 < bits.size() && (bits[i / 64] >> (i % 64) & 1);
+    }
+
+    /// Marca un ID del tramo; devuelve false si ya estaba marcado.
+    bool agregar(int id) {
+        if (contiene(id)) return false;
+        size_t i = (size_t)(id - primerId);
+        bits[i / 64] |= uint64_t(1) << (i % 64);
+        cantidad++;
+        return true;
+    }
+
+    int tamano() const { return cantidad; }
+
+    /// Llama a f(id) con cada ID marcado, en orden creciente.
+    template <class F>
+    void recorrer(F f) const {
+        for (size_t p = 0; p < bits.size(); p++)
+            for (uint64_t w = bits[p]; w; w &= w - 1)
+                f(primerId + (int)(p * 64 + ctz64(w)));
+    }
+};
+
+/**
+ * @brief Indica si un ID está en un mapa de borrados que puede ser nulo.
+ */
+inline bool estaBorrado(const MapaBorrados* borrados, int id) {
+    return borrados && borrados->contiene(id);
+}
+
+/**
+ * @struct IndiceCampo
+ * @brief Índice invertido de un campo dentro de un segmento: términos con
+ *        IDs locales, sus listas de postings y el diccionario ordenado.
+ */
+struct IndiceCampo {
+    TablaTerminos terminos;
+    vector<ListaPostings> postings;        ///< ID de término -> postings
+    TrieTerminos diccionario;              ///< Términos en orden lexicográfico
+
+    size_t tamano() const { return terminos.tamano(); }
+
+    /**
+     * @brief Devuelve el ID de un término, registrándolo (con su lista de
+     *        postings vacía y en el diccionario) si es nuevo.
+     */
+    int internar(const string& termino) {
+        size_t antes = terminos.tamano();
+        int id = terminos.internar(termino);
+        if (terminos.tamano() > antes) {
+            postings.emplace_back();
+            diccionario.insertar(terminos.texto(id), id);
+        }
+        return id;
+    }
+
+    /**
+     * @brief Lista de postings de un término, o nullptr si no está indexado.
+     */
+    const ListaPostings* buscar(const string& termino) const {
+        int id = terminos.buscar(termino);
+        return id < 0 ? nullptr : &postings[id];
+    }
+};
+
+/**
+ * @brief Claves con las que se indexa un remitente ya normalizado en el
+ *        campo "de": la dirección completa y cada sufijo de su dominio
+ *        ("ana@unal.edu.co", "unal.edu.co", "edu.co", "co").
+ */
+vector<string> clavesRemitente(const string& normal) {
+    vector<string> claves = {normal};
+    size_t arroba = normal.rfind('@');
+    if (arroba == string::npos) return claves;
+    for (size_t p = arroba; p != string::npos && p + 1 < normal.size(); p = normal.find('.', p + 1))
+        claves.push_back(normal.substr(p + 1));
+    return claves;
+}
+
+/**
+ * @brief Invierte las etiquetas de un dominio ("unal.edu.co" -> "co.edu.unal"),
+ *        para que un dominio y sus subdominios compartan prefijo.
+ */
+string invertirDominio(string_view dominio) {
+    string out;
+    while (!dominio.empty()) {
+        size_t p = dominio.rfind('.');
+        if (!out.empty()) out += '.';
+        if (p == string_view::npos) {
+            out += dominio;
+            break;
+        }
+        out += dominio.substr(p + 1);
+        dominio = dominio.substr(0, p);
+    }
+    return out;
+}
+
+/**
+ * @brief Clave de un remitente ya normalizado en el orden por dominio: el
+ *        dominio invertido, '@' y la parte local ("ana@mail.unal.edu.co" ->
+ *        "co.edu.unal.mail@ana"). Una dirección sin '@' queda con dominio
+ *        vacío.
+ */
+string claveDominio(const string& normal) {
+    size_t arroba = normal.rfind('@');
+    if (arroba == string::npos) return "@" + normal;
+    return invertirDominio(string_view(normal).substr(arroba + 1)) + "@" + normal.substr(0, arroba);
+}
+
+/**
+ * @struct Segmento
+ * @brief Índices de los correos con ID en [primerId, primerId + nCorreos):
+ *        invertidos (del texto completo y por campo), por remitente, por
+ *        fecha y longitudes para BM25.
+ *
+ * Los IDs de término y de remitente son locales al segmento. Como los IDs
+ * de correo se asignan de forma creciente, basta con agregar al final para
+ * mantener ordenada cada lista.
+ *
+ * Los remitentes están además en dos tries: por dirección, para buscar por
+ * prefijo, y por claveDominio(), donde los de un dominio y sus subdominios
+ * forman un rango contiguo.
+ *
+ * El índice `texto` junta asunto y cuerpo y es el que usan las consultas
+ * sin campo y el ranking. `asunto` repite solo los términos del asunto, que
+ * son pocos; el cuerpo no tiene índice propio porque sus frecuencias son
+ * las de `texto` menos las de `asunto`.
+ *
+ * Un segmento nacido de una fusión no indexa los correos que ya estaban
+ * borrados (descartados); conserva su lugar en el tramo con longitud 0.
+ */
+struct Segmento {
+    uint64_t numero = 0;                   ///< Identifica al segmento sellado (y su archivo)
+    int primerId = 1;
+    int nCorreos = 0;                      ///< Tamaño del tramo de IDs
+    shared_ptr<const MapaBorrados> descartados;   ///< Borrados fuera de los índices (o nullptr)
+    IndiceCampo texto;                     ///< Asunto y cuerpo
+    IndiceCampo asunto;                    ///< Solo el asunto (consultas "asunto:")
+    IndiceCampo remitente;                 ///< clavesRemitente() de cada correo (consultas "de:")
+    vector<int> longitudes;                ///< Longitud en términos, en id - primerId
+    long long totalTerminos = 0;
+    TablaTerminos remitentes;              ///< Direcciones normalizadas
+    vector<vector<int>> correosPorRemitente;   ///< ID de remitente -> IDs de correo
+    vector<vector<int>> clavesPorRemitente;    ///< Al indexar: ID de remitente -> IDs en `remitente`
+    TrieTerminos ordenDirecciones;         ///< Remitentes en orden de dirección
+    TrieTerminos ordenDominios;            ///< Remitentes en orden de claveDominio()
+    CalendarioCorreos calendario;          ///< Orden por fecha, particionado por mes
+
+    int ultimoId() const { return primerId + nCorreos - 1; }
+
+    /// Correos del tramo que siguen en los índices.
+    int vigentes() const { return nCorreos - (descartados ? descartados->tamano() : 0); }
+
+    int longitud(int id) const { return longitudes[id - primerId]; }
+
+    /**
+     * @brief Lista de postings de un término en el texto completo, o
+     *        nullptr si no está indexado.
+     */
+    const ListaPostings* buscarPostings(const string& termino) const { return texto.buscar(termino); }
+
+    /**
+     * @brief Lista de correos de un remitente ya normalizado, creándola si
+     *        es nuevo.
+     */
+    vector<int>& listaRemitente(const string& normal) {
+        return correosPorRemitente[registrarRemitente(normal)];
+    }
+
+    /**
+     * @brief ID de un remitente ya normalizado. Si es nuevo le crea su lista
+     *        de correos y lo inserta en los dos órdenes.
+     */
+    int registrarRemitente(const string& normal) {
+        int id = remitentes.internar(normal);
+        if ((size_t)id == correosPorRemitente.size()) {
+            correosPorRemitente.emplace_back();
+            ordenDirecciones.insertar(remitentes.texto(id), id);
+            ordenDominios.insertar(claveDominio(normal), id);
+        }
+        return id;
+    }
+
+    /**
+     * @brief Agrega el correo a las listas de su remitente, ya normalizado:
+     *        la de correosPorRemitente y las del campo "de".
+     */
+    void indexarRemitente(int id, const string& normal) {
+        int r = registrarRemitente(normal);
+        correosPorRemitente[r].push_back(id);
+        if ((size_t)r >= clavesPorRemitente.size()) clavesPorRemitente.resize(r + 1);
+        if (clavesPorRemitente[r].empty()) {
+            for (const string& clave : clavesRemitente(normal))
+                clavesPorRemitente[r].push_back(remitente.internar(clave));
+        }
+        for (int clave : clavesPorRemitente[r]) remitente.postings[clave].agregar(id, 1);
+    }
+
+    /**
+     * @brief Agrega un correo del almacén, que debe tener el ID siguiente
+     *        al último del segmento. El cuerpo va aparte porque el del
+     *        almacén puede estar solo en disco.
+     */
+    void indexar(const Correo& c, string_view cuerpo, Tokenizador& tok) {
+        int longitud = tok.contar(c.asunto, cuerpo,
+                                  [this](const string& t) { return texto.internar(t); });
+        for (auto [idTermino, frecuencia] : tok.fila())
+            texto.postings[idTermino].agregar(c.id, frecuencia);
+        tok.contarCampo(c.asunto, [this](const string& t) { return asunto.internar(t); });
+        for (auto [idTermino, frecuencia] : tok.fila())
+            asunto.postings[idTermino].agregar(c.id, frecuencia);
+        longitudes.push_back(longitud);
+        totalTerminos += longitud;
+        indexarRemitente(c.id, normalizarRemitente(c.remitente));
+        calendario.insertar(c);
+        nCorreos++;
+    }
+};
+
+/**
+ * @struct VistaIndice
+ * @brief Conjunto inmutable de segmentos publicados, en orden de IDs, con
+ *        los correos borrados de cada uno y las estadísticas globales que
+ *        usa el ranking.
+ *
+ * Borrar no toca los segmentos: publica una vista con otro mapa de borrados
+ * y las consultas filtran con él. Las estadísticas siguen contando a los
+ * borrados hasta que una fusión los descarta.
+ */
+struct VistaIndice {
+    vector<shared_ptr<const Segmento>> segmentos;
+    vector<shared_ptr<const MapaBorrados>> borrados;   ///< Paralelo a segmentos (nullptr = ninguno)
+    int nCorreos = 0;
+    long long totalTerminos = 0;
+    uint64_t generacion = 0;   ///< Crece con cada publicación
+    /// Borrados del segmento abierto, que aún no está en la vista; pasan a
+    /// `borrados` cuando se sella (nullptr = ninguno)
+    shared_ptr<const MapaBorrados> borradosAbierto;
+
+    /// Posición del segmento cuyo tramo contiene el ID, o segmentos.size().
+    size_t segmentoDe(int id) const {
+        auto it = upper_bound(segmentos.begin(), segmentos.end(), id,
+                              [](int x, const shared_ptr<const Segmento>& s) { return x < s->primerId; });
+        if (it == segmentos.begin() || (*--it)->ultimoId() < id) return segmentos.size();
+        return (size_t)(it - segmentos.begin());
+    }
+
+    bool correoBorrado(int id) const {
+        size_t i = segmentoDe(id);
+        if (i == segmentos.size()) return estaBorrado(borradosAbierto.get(), id);
+        return estaBorrado(borrados[i].get(), id);
+    }
+
+    /// Borrados del segmento i que sus índices todavía incluyen.
+    int borradosPendientes(size_t i) const {
+        int total = borrados[i] ? borrados[i]->tamano() : 0;
+        return total - (segmentos[i]->nCorreos - segmentos[i]->vigentes());
+    }
+};
+
+/// Vista vigente; solo se lee y se reemplaza con atomic_load/atomic_store.
+shared_ptr<const VistaIndice> vistaPublicada = make_shared<const VistaIndice>();
+
+/// Serializa a los escritores; los lectores nunca lo toman.
+mutex mutexEscritor;
+
+/// Segmento que está llenando el escritor (protegido por mutexEscritor).
+unique_ptr<Segmento> segmentoAbierto;
+
+/// Momento en que se creó el segmento abierto (protegido por mutexEscritor).
+chrono::steady_clock::time_point segmentoAbiertoDesde;
+
+/// Número del próximo segmento sellado (protegido por mutexEscritor).
+uint64_t siguienteNumeroSegmento = 1;
+
+/// Correos a partir de los cuales crearCorreo publica el segmento abierto.
+const int TAM_SEGMENTO_ABIERTO = 4096;
+/// Segmentos contiguos de un mismo nivel que se fusionan en uno.
+const size_t FACTOR_FUSION = 4;
+
+/**
+ * @brief Vista vigente de los índices. Puede usarse sin candados durante
+ *        toda la consulta, mientras se retenga el puntero.
+ */
+shared_ptr<const VistaIndice> vistaActual() {
+    return atomic_load(&vistaPublicada);
+}
+
+/**
+ * @brief Segmento abierto, creándolo a continuación del último correo del
+ *        almacén si no hay uno. Requiere mutexEscritor.
+ */
+Segmento& segmentoParaEscribir() {
+    if (!segmentoAbierto) {
+        segmentoAbierto = make_unique<Segmento>();
+        segmentoAbierto->primerId = (int)almacenCorreos.tamano() + 1;
+        segmentoAbiertoDesde = chrono::steady_clock::now();
+    }
+    return *segmentoAbierto;
+}
+
+/**
+ * @brief Une mapas de borrados (nulos incluidos) de segmentos contiguos en
+ *        uno sobre el tramo [primerId, primerId + n).
+ * @return El mapa unido, o nullptr si no hay ningún borrado.
+ */
+shared_ptr<const MapaBorrados> unirBorrados(int primerId, int n,
+                                            const vector<const MapaBorrados*>& mapas) {
+    auto unido = make_shared<MapaBorrados>(primerId, n);
+    for (const MapaBorrados* m : mapas)
+        if (m) m->recorrer([&](int id) { unido->agregar(id); });
+    if (unido->tamano() == 0) return nullptr;
+    return unido;
+}
+
+/**
+ * @brief Sella el segmento abierto (si tiene correos) y lo agrega a una
+ *        vista todavía no publicada. Requiere mutexEscritor.
+ */
+void sellarSegmentoAbierto(VistaIndice& nueva) {
+    if (!segmentoAbierto || segmentoAbierto->nCorreos == 0) return;
+    segmentoAbierto->numero = siguienteNumeroSegmento++;
+    shared_ptr<const Segmento> sellado = move(segmentoAbierto);
+    nueva.segmentos.push_back(sellado);
+    // El mapa del segmento abierto puede ser más corto que el tramo sellado
+    nueva.borrados.push_back(
+        nueva.borradosAbierto
+            ? unirBorrados(sellado->primerId, sellado->nCorreos, {nueva.borradosAbierto.get()})
+            : nullptr);
+    nueva.borradosAbierto = nullptr;
+    nueva.nCorreos += sellado->nCorreos;
+    nueva.totalTerminos += sellado->totalTerminos;
+}
+
+/**
+ * @brief Sella el segmento abierto y publica una vista que lo incluye.
+ *        Requiere mutexEscritor.
+ */
+void publicarSegmentoAbierto() {
+    if (!segmentoAbierto || segmentoAbierto->nCorreos == 0) return;
+    auto nueva = make_shared<VistaIndice>(*vistaActual());
+    sellarSegmentoAbierto(*nueva);
+    nueva->generacion++;
+    atomic_store(&vistaPublicada, shared_ptr<const VistaIndice>(move(nueva)));
+}
+
+/**
+ * @brief Hace visibles para las consultas los correos creados hasta ahora.
+ */
+void publicarCorreos() {
+    lock_guard<mutex> bloqueo(mutexEscritor);
+    publicarSegmentoAbierto();
+}
+
+/**
+ * @brief Marca un correo como borrado en una vista todavía no publicada,
+ *        con una copia del mapa de borrados de su segmento. Los del
+ *        segmento abierto se marcan en borradosAbierto, sin sellarlo.
+ *        Requiere mutexEscritor.
+ * @return false si el ID no está en la vista ni en el segmento abierto, o
+ *         ya estaba borrado.
+ */
+bool marcarBorrado(VistaIndice& nueva, int id) {
+    if (segmentoAbierto && id >= segmentoAbierto->primerId && id <= segmentoAbierto->ultimoId()) {
+        if (estaBorrado(nueva.borradosAbierto.get(), id)) return false;
+        auto mapa = make_shared<MapaBorrados>(segmentoAbierto->primerId, segmentoAbierto->nCorreos);
+        if (nueva.borradosAbierto) nueva.borradosAbierto->recorrer([&](int b) { mapa->agregar(b); });
+        mapa->agregar(id);
+        nueva.borradosAbierto = move(mapa);
+        return true;
+    }
+    size_t i = nueva.segmentoDe(id);
+    if (i == nueva.segmentos.size() || nueva.correoBorrado(id)) return false;
+    const Segmento& s = *nueva.segmentos[i];
+    auto mapa = nueva.borrados[i] ? make_shared<MapaBorrados>(*nueva.borrados[i])
+                                  : make_shared<MapaBorrados>(s.primerId, s.nCorreos);
+    mapa->agregar(id);
+    nueva.borrados[i] = move(mapa);
+    return true;
+}
+
+/// Fracción de borrados pendientes a partir de la cual se compacta un segmento.
+const double UMBRAL_COMPACTACION = 0.2;
+
+/**
+ * @brief Nivel LSM de un segmento: 0 por debajo de FACTOR_FUSION correos
+ *        vigentes, y uno más por cada multiplicación por FACTOR_FUSION.
+ *
+ * Así solo se fusionan segmentos de tamaño parecido: los de un correo que
+ * sella cada confirmar() se juntan entre sí, y uno grande no se reescribe
+ * por cada puñado de altas.
+ */
+int nivelSegmento(const Segmento& s) {
+    int nivel = 0;
+    for (long long tope = (long long)FACTOR_FUSION; s.vigentes() >= tope; tope *= FACTOR_FUSION)
+        nivel++;
+    return nivel;
+}
+
+/**
+ * @struct GrupoFusion
+ * @brief Segmentos contiguos de una vista que se reescriben en uno, con los
+ *        mapas de borrados que tenían al elegirlos.
+ */
+struct GrupoFusion {
+    vector<shared_ptr<const Segmento>> segmentos;
+    vector<shared_ptr<const MapaBorrados>> borrados;
+};
+
+/**
+ * @brief Elige FACTOR_FUSION segmentos contiguos del mismo nivel, los más
+ *        antiguos que haya. Si no hay, elige para compactar el primer
+ *        segmento cuyos borrados pendientes superen UMBRAL_COMPACTACION.
+ * @return Los segmentos a reescribir, o vacío si no hace falta.
+ */
+GrupoFusion elegirFusion(const VistaIndice& vista) {
+    const auto& segs = vista.segmentos;
+    auto tomar = [&](size_t i, size_t n) {
+        return GrupoFusion{vector<shared_ptr<const Segmento>>(segs.begin() + i, segs.begin() + i + n),
+                           vector<shared_ptr<const MapaBorrados>>(vista.borrados.begin() + i,
+                                                                  vista.borrados.begin() + i + n)};
+    };
+    for (size_t i = 0; i < segs.size();) {
+        size_t j = i + 1;
+        while (j < segs.size() && nivelSegmento(*segs[j]) == nivelSegmento(*segs[i])) j++;
+        if (j - i >= FACTOR_FUSION) return tomar(i, FACTOR_FUSION);
+        i = j;
+    }
+    for (size_t i = 0; i < segs.size(); i++)
+        if (vista.borradosPendientes(i) > 0 &&
+            vista.borradosPendientes(i) >= UMBRAL_COMPACTACION * segs[i]->nCorreos)
+            return tomar(i, 1);
+    return {};
+}
+
+/**
+ * @brief Arma un segmento con el contenido de segmentos contiguos, en
+ *        orden de IDs, descartando los correos borrados. Solo lee los
+ *        segmentos, que son inmutables, así que no requiere candados. Los
+ *        términos y remitentes se internan en el orden de los segmentos,
+ *        por lo que el resultado es determinista.
+ */
+unique_ptr<Segmento> fusionarSegmentos(const GrupoFusion& grupo) {
+    auto fusion = make_unique<Segmento>();
+    fusion->primerId = grupo.segmentos.front()->primerId;
+    vector<const MapaBorrados*> mapas;
+    vector<const Correo*> ordenados;
+
+    for (size_t g = 0; g < grupo.segmentos.size(); g++) {
+        const Segmento& s = *grupo.segmentos[g];
+        const MapaBorrados* borrados = grupo.borrados[g].get();
+        mapas.push_back(borrados);
+
+        // Los términos y remitentes sin correos vigentes no pasan a la fusión
+        auto fusionarCampo = [borrados](IndiceCampo& destino, const IndiceCampo& origen) {
+            for (size_t t = 0; t < origen.tamano(); t++) {
+                int id = -1;
+                for (ListaPostings::Cursor cur(origen.postings[t]); !cur.fin(); cur.siguiente()) {
+                    if (estaBorrado(borrados, cur.doc())) continue;
+                    if (id < 0) id = destino.internar(origen.terminos.texto((int)t));
+                    destino.postings[id].agregar(cur.doc(), cur.frecuencia());
+                }
+            }
+        };
+        fusionarCampo(fusion->texto, s.texto);
+        fusionarCampo(fusion->asunto, s.asunto);
+        fusionarCampo(fusion->remitente, s.remitente);
+        for (size_t r = 0; r < s.remitentes.tamano(); r++) {
+            vector<int>* lista = nullptr;
+            for (int id : s.correosPorRemitente[r]) {
+                if (estaBorrado(borrados, id)) continue;
+                if (!lista) lista = &fusion->listaRemitente(s.remitentes.texto((int)r));
+                lista->push_back(id);
+            }
+        }
+        for (int id = s.primerId; id <= s.ultimoId(); id++) {
+            int longitud = estaBorrado(borrados, id) ? 0 : s.longitud(id);
+            fusion->longitudes.push_back(longitud);
+            fusion->totalTerminos += longitud;
+        }
+        fusion->nCorreos += s.nCorreos;
+
+        // Mezcla el orden por fecha del segmento con el acumulado
+        size_t medio = ordenados.size();
+        for (const Correo* c : s.calendario.obtenerOrdenados())
+            if (!estaBorrado(borrados, c->id)) ordenados.push_back(c);
+        inplace_merge(ordenados.begin(), ordenados.begin() + medio, ordenados.end(),
+                      ArbolCorreos::menor);
+    }
+    fusion->calendario.construirDesdeOrdenados(ordenados);
+    fusion->descartados = unirBorrados(fusion->primerId, fusion->nCorreos, mapas);
+    return fusion;
+}
+
+/**
+ * @brief Reemplaza en la vista vigente los segmentos del grupo por su
+ *        fusión y la publica. Los correos borrados mientras se armaba la
+ *        fusión siguen marcados en la vista nueva.
+ * @return false si el grupo ya no está en la vista.
+ */
+bool instalarFusion(const GrupoFusion& grupo, unique_ptr<Segmento> fusion) {
+    lock_guard<mutex> bloqueo(mutexEscritor);
+    shared_ptr<const VistaIndice> vista = vistaActual();
+    const auto& segs = vista->segmentos;
+    const auto& g = grupo.segmentos;
+    auto it = find(segs.begin(), segs.end(), g.front());
+    if ((size_t)(segs.end() - it) < g.size() || !equal(g.begin(), g.end(), it))
+        return false;
+
+    size_t pos = (size_t)(it - segs.begin());
+    vector<const MapaBorrados*> mapas;
+    for (size_t i = pos; i < pos + g.size(); i++) mapas.push_back(vista->borrados[i].get());
+
+    fusion->numero = siguienteNumeroSegmento++;
+    auto nueva = make_shared<VistaIndice>(*vista);
+    for (const auto& s : g) nueva->totalTerminos -= s->totalTerminos;
+    nueva->totalTerminos += fusion->totalTerminos;
+    nueva->borrados[pos] = unirBorrados(fusion->primerId, fusion->nCorreos, mapas);
+    nueva->borrados.erase(nueva->borrados.begin() + pos + 1, nueva->borrados.begin() + pos + g.size());
+    nueva->segmentos[pos] = shared_ptr<const Segmento>(move(fusion));
+    nueva->segmentos.erase(nueva->segmentos.begin() + pos + 1, nueva->segmentos.begin() + pos + g.size());
+    nueva->generacion++;
+    atomic_store(&vistaPublicada, shared_ptr<const VistaIndice>(move(nueva)));
+    return true;
+}
+
+/**
+ * @brief Correos no borrados de los remitentes que calzan con `patron` (se
+ *        normaliza antes de buscar), en orden de fecha. El patrón puede ser
+ *        una dirección ("ana@unal.edu.co"), un dominio precedido de '@'
+ *        ("@unal.edu.co", incluye sus subdominios) o el comienzo de una
+ *        dirección terminado en '*' ("ana*").
+ *
+ * Los remitentes se recorren por rango en los tries de cada segmento, así
+ * que el costo depende de los remitentes y correos que calzan, no del total.
+ * Devuelve punteros al almacén, sin copiar los correos.
+ */
+vector<const Correo*> correosDeRemitentes(const VistaIndice& vista, string_view patron) {
+    string normal = normalizarRemitente(patron);
+    bool porDominio = !normal.empty() && normal[0] == '@';
+    bool porPrefijo = !porDominio && !normal.empty() && normal.back() == '*';
+    vector<string> prefijos;
+    if (porDominio) {
+        string invertido = invertirDominio(string_view(normal).substr(1));
+        if (invertido.empty()) return {};
+        prefijos = {invertido + "@", invertido + "."};
+    } else if (porPrefijo) {
+        normal.pop_back();
+        prefijos = {normal};
+    }
+
+    vector<const Correo*> out;
+    for (size_t i = 0; i < vista.segmentos.size(); i++) {
+        const Segmento& s = *vista.segmentos[i];
+        const MapaBorrados* borrados = vista.borrados[i].get();
+        auto agregar = [&](int r) {
+            for (int c : s.correosPorRemitente[r])
+                if (!estaBorrado(borrados, c)) out.push_back(almacenCorreos.buscar(c));
+        };
+        if (!porDominio && !porPrefijo) {
+            int r = s.remitentes.buscar(normal);
+            if (r >= 0) agregar(r);
+            continue;
+        }
+        const TrieTerminos& orden = porDominio ? s.ordenDominios : s.ordenDirecciones;
+        for (const string& p : prefijos)
+            for (int r : orden.conPrefijo(p)) agregar(r);
+    }
+    sort(out.begin(), out.end(), ArbolCorreos::menor);
+    return out;
+}
+
+/**
+ * @brief Indica si algún segmento de la vista tiene el término.
+ */
+bool terminoIndexado(const VistaIndice& vista, const string& termino) {
+    for (const auto& s : vista.segmentos)
+        if (s->texto.terminos.buscar(termino) >= 0) return true;
+    return false;
+}
+
+/**
+ * @brief Hasta `limite` términos indexados a distancia de edición <=
+ *        maxDist de `palabra`, ordenados por distancia y luego
+ *        alfabéticamente, sin repetir los que estén en varios segmentos.
+ */
+vector<string> terminosSimilares(const VistaIndice& vista, string_view palabra, int maxDist,
+                                 size_t limite) {
+    vector<pair<int, string>> todos;
+    for (const auto& s : vista.segmentos)
+        for (auto [dist, id] : s->texto.diccionario.similares(palabra, maxDist))
+            todos.push_back({dist, s->texto.terminos.texto(id)});
+    sort(todos.begin(), todos.end());
+    vector<string> out;
+    for (auto& [dist, t] : todos) {
+        if (out.size() == limite) break;
+        if (find(out.begin(), out.end(), t) == out.end()) out.push_back(move(t));
+    }
+    return out;
+}
+
+/**
+ * @class CursorFechas
+ * @brief Recorrido en orden de fecha de todos los segmentos de una vista:
+ *        mezcla los cursores de sus calendarios eligiendo en cada paso el
+ *        menor por (fecha, ID) y salta los correos borrados. Retiene la
+ *        vista, así que sigue siendo válido aunque se publiquen correos
+ *        nuevos. Los meses fuera del intervalo no se visitan.
+ */
+class CursorFechas {
+private:
+    shared_ptr<const VistaIndice> vista;
+    vector<CalendarioCorreos::Cursor> cursores;
+    size_t menor = 0;   ///< Cursor con el correo actual (cursores.size() = fin)
+
+    void elegir() {
+        menor = cursores.size();
+        for (size_t i = 0; i < cursores.size(); i++) {
+            const MapaBorrados* borrados = vista->borrados[i].get();
+            while (cursores[i].valido() && estaBorrado(borrados, cursores[i].actual()->id))
+                cursores[i].avanzar();
+            if (!cursores[i].valido()) continue;
+            if (menor == cursores.size() ||
+                ArbolCorreos::menor(cursores[i].actual(), cursores[menor].actual()))
+                menor = i;
+        }
+    }
+
+public:
+    /**
+     * @brief Cursor sobre los correos con fecha en [desde, hasta).
+     */
+    CursorFechas(shared_ptr<const VistaIndice> v, Fecha desde = 0, Fecha hasta = FECHA_MAXIMA)
+        : vista(move(v)) {
+        for (const auto& s : vista->segmentos) cursores.push_back(s->calendario.rango(desde, hasta));
+        elegir();
+    }
+
+    bool valido() const { return menor < cursores.size(); }
+
+    /// Correo en la posición actual (requiere valido()).
+    const Correo* actual() const { return cursores[menor].actual(); }
+
+    void avanzar() {
+        cursores[menor].avanzar();
+        elegir();
+    }
+
+    /**
+     * @brief Devuelve hasta `n` correos a partir de la posición actual y
+     *        deja el cursor en el primero no devuelto.
+     */
+    vector<const Correo*> siguientes(size_t n) {
+        vector<const Correo*> pagina;
+        while (pagina.size() < n && valido()) {
+            pagina.push_back(actual());
+            avanzar();
+        }
+        return pagina;
+    }
+};
+
+// ============================================================================
+// CREAR, BORRAR Y EDITAR CORREOS
+// ============================================================================
+/**
+ * @brief Busca un correo por ID en el almacén central. No toma candados.
+ * @return Puntero al correo o nullptr si el ID no existe o está borrado.
+ */
+const Correo* buscarPorID(int id) {
+    const Correo* c = almacenCorreos.buscar(id);
+    if (c && vistaActual()->correoBorrado(id)) return nullptr;
+    return c;
+}
+
+void anotarEnDiario(const Correo& c);
+void anotarBorradoEnDiario(int id);
+
+/**
+ * @brief Anota un correo en el diario, guarda su cuerpo en el almacén de
+ *        cuerpos si está activo, lo guarda en el almacén y lo indexa en el
+ *        segmento abierto. Requiere mutexEscritor.
+ */
+const Correo& agregarCorreo(string_view rem, string_view asu, string_view cue, Fecha fecha) {
+    Segmento& seg = segmentoParaEscribir();
+    Correo nuevo{0, string(rem), string(asu), string(cue), fecha};
+    anotarEnDiario(nuevo);
+    if (almacenCuerpos.activo() && !cue.empty()) {
+        uint64_t posicion = almacenCuerpos.agregar(cue);
+        if (almacenCuerpos.escribirPendiente()) {
+            nuevo.cuerpo = string();
+            nuevo.largoCuerpo = (uint32_t)cue.size();
+            nuevo.posicionCuerpo = posicion;
+        }
+    }
+    const Correo& c = almacenCorreos.agregar(move(nuevo));
+    seg.indexar(c, cue, tokenizador);
+    return c;
+}
+
+/**
+ * @brief Crea un correo nuevo, lo guarda en el almacén central y lo indexa
+ *        en el segmento abierto. Si hay un diario activo, el correo también
+ *        se anota en él para que persista. Es seguro llamarla desde varios
+ *        hilos; los correos quedan visibles para las búsquedas cuando se
+ *        publica el segmento (al llenarse o con publicarCorreos()).
+ * @return Referencia estable al correo dentro del almacén.
+ */
+const Correo& crearCorreo(string_view rem, string_view asu, string_view cue, Fecha fecha) {
+    MedirLatencia medir(OP_CREAR);
+    lock_guard<mutex> bloqueo(mutexEscritor);
+    const Correo& c = agregarCorreo(rem, asu, cue, fecha);
+    if (segmentoAbierto->nCorreos >= TAM_SEGMENTO_ABIERTO) publicarSegmentoAbierto();
+    return c;
+}
+
+/**
+ * @brief Publica una vista con el correo marcado como borrado. Requiere
+ *        mutexEscritor.
+ * @return false si el ID no existe o ya estaba borrado.
+ */
+bool publicarBorrado(int id) {
+    auto nueva = make_shared<VistaIndice>(*vistaActual());
+    if (!marcarBorrado(*nueva, id)) return false;
+    nueva->generacion++;
+    atomic_store(&vistaPublicada, shared_ptr<const VistaIndice>(move(nueva)));
+    anotarBorradoEnDiario(id);
+    return true;
+}
+
+/**
+ * @brief Borra un correo: deja de aparecer en búsquedas, listados y en
+ *        buscarPorID desde que vuelve. El borrado se anota en el diario; los
+ *        índices lo descartan en la próxima fusión de su segmento, y el
+ *        texto sale del disco al guardarse el segmento fusionado.
+ * @return false si el ID no existe o ya estaba borrado.
+ */
+bool borrarCorreo(int id) {
+    MedirLatencia medir(OP_BORRAR);
+    lock_guard<mutex> bloqueo(mutexEscritor);
+    return publicarBorrado(id);
+}
+
+/**
+ * @brief Reemplaza un correo por una versión editada: crea el correo nuevo
+ *        y publica en una misma vista su alta y el borrado del original, así
+ *        que ninguna consulta ve a los dos ni a ninguno. El correo editado
+ *        recibe un ID nuevo, porque los tramos de los segmentos solo crecen.
+ *        Si el original sigue en el segmento abierto, ninguno de los dos es
+ *        visible todavía y el segmento no se sella.
+ * @return El correo nuevo, o nullptr si el ID no existe o está borrado.
+ */
+const Correo* actualizarCorreo(int id, string_view rem, string_view asu, string_view cue,
+                               Fecha fecha) {
+    lock_guard<mutex> bloqueo(mutexEscritor);
+    if (!almacenCorreos.buscar(id) || vistaActual()->correoBorrado(id)) return nullptr;
+    bool originalAbierto = segmentoAbierto && id >= segmentoAbierto->primerId;
+    const Correo& c = agregarCorreo(rem, asu, cue, fecha);
+    auto nueva = make_shared<VistaIndice>(*vistaActual());
+    if (!originalAbierto) sellarSegmentoAbierto(*nueva);
+    marcarBorrado(*nueva, id);
+    nueva->generacion++;
+    atomic_store(&vistaPublicada, shared_ptr<const VistaIndice>(move(nueva)));
+    anotarBorradoEnDiario(id);
+    return &c;
+}
+
+// ============================================================================
+// CONSULTAS BOOLEANAS SOBRE EL ÍNDICE INVERTIDO
+// ============================================================================
+/*
+ * Las listas de postings están ordenadas, así que AND, OR y NOT se
+ * resuelven con intersecciones, uniones y diferencias lineales. Cuando una
+ * lista es mucho más corta que la otra, la intersección galopa (búsqueda
+ * exponencial seguida de binaria) sobre la larga, con costo
+ * O(m log(n / m)). Si son parecidas, se compara cada elemento contra
+ * bloques de 8 IDs de la otra lista con instrucciones SSE2.
+ */
+
+/// Razón de tamaños a partir de la cual la intersección galopa.
+const size_t RAZON_GALOPE = 32;
+
+/**
+ * @brief Intersección galopando: por cada ID de `chica` se busca en
+ *        `grande` desde la última posición encontrada.
+ */
+void intersectarGalopando(const vector<int>& chica, const vector<int>& grande, vector<int>& out) {
+    size_t j = 0, n = grande.size();
+    for (int x : chica) {
+        size_t paso = 1;
+        while (j + paso < n && grande[j + paso] < x) {
+            j += paso;
+            paso *= 2;
+        }
+        j = lower_bound(grande.begin() + j, grande.begin() + min(n, j + paso + 1), x)
+            - grande.begin();
+        if (j == n) return;
+        if (grande[j] == x) out.push_back(x);
+    }
+}
+
+/**
+ * @brief Intersección por mezcla. Con SSE2 cada ID de `a` se compara a la
+ *        vez contra 8 IDs de `b`, saltando bloques completos de `b` que
+ *        quedan por debajo.
+ */
+void intersectarMezcla(const vector<int>& a, const vector<int>& b, vector<int>& out) {
+    size_t i = 0, j = 0, na = a.size(), nb = b.size();
+#ifdef __SSE2__
+    while (i < na && j + 8 <= nb) {
+        if (b[j + 7] < a[i]) {
+            j += 8;
+            continue;
+        }
+        __m128i x = _mm_set1_epi32(a[i]);
+        __m128i b0 = _mm_loadu_si128((const __m128i*)(b.data() + j));
+        __m128i b1 = _mm_loadu_si128((const __m128i*)(b.data() + j + 4));
+        __m128i eq = _mm_or_si128(_mm_cmpeq_epi32(x, b0), _mm_cmpeq_epi32(x, b1));
+        if (_mm_movemask_epi8(eq)) out.push_back(a[i]);
+        i++;
+    }
+#endif
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) i++;
+        else if (b[j] < a[i]) j++;
+        else {
+            out.push_back(a[i]);
+            i++;
+            j++;
+        }
+    }
+}
+
+/**
+ * @brief Intersección de dos listas ordenadas; elige el algoritmo según
+ *        la diferencia de tamaños.
+ */
+vector<int> intersectar(const vector<int>& a, const vector<int>& b) {
+    const vector<int>& chica = a.size() <= b.size() ? a : b;
+    const vector<int>& grande = a.size() <= b.size() ? b : a;
+    vector<int> out;
+    out.reserve(chica.size());
+    if (chica.size() * RAZON_GALOPE < grande.size())
+        intersectarGalopando(chica, grande, out);
+    else
+        intersectarMezcla(chica, grande, out);
+    return out;
+}
+
+/**
+ * @brief Unión de dos listas ordenadas, sin repetidos.
+ */
+vector<int> unir(const vector<int>& a, const vector<int>& b) {
+    vector<int> out;
+    out.reserve(a.size() + b.size());
+    set_union(a.begin(), a.end(), b.begin(), b.end(), back_inserter(out));
+    return out;
+}
+
+/**
+ * @brief Diferencia a \ b de dos listas ordenadas. Si `a` es mucho más
+ *        corta, galopa sobre `b`.
+ */
+vector<int> restar(const vector<int>& a, const vector<int>& b) {
+    vector<int> out;
+    if (a.size() * RAZON_GALOPE < b.size()) {
+        vector<int> comunes;
+        intersectarGalopando(a, b, comunes);
+        set_difference(a.begin(), a.end(), comunes.begin(), comunes.end(), back_inserter(out));
+    } else {
+        set_difference(a.begin(), a.end(), b.begin(), b.end(), back_inserter(out));
+    }
+    return out;
+}
+
+/**
+ * @brief Intersección de una lista explícita con una lista de postings. Si
+ *        `ids` es mucho más corta, se recorre la lista comprimida con un
+ *        cursor que salta bloques; si no, se descomprime completa.
+ */
+vector<int> intersectar(const vector<int>& ids, const ListaPostings& lista) {
+    if (ids.size() * RAZON_GALOPE >= lista.tamano())
+        return intersectar(ids, lista.decodificarIds());
+    vector<int> out;
+    ListaPostings::Cursor cur(lista);
+    for (int x : ids) {
+        cur.avanzarHasta(x);
+        if (cur.fin()) break;
+        if (cur.doc() == x) out.push_back(x);
+    }
+    return out;
+}
+
+/**
+ * @brief Diferencia ids \ lista, con el mismo criterio que intersectar().
+ */
+vector<int> restar(const vector<int>& ids, const ListaPostings& lista) {
+    if (ids.size() * RAZON_GALOPE >= lista.tamano())
+        return restar(ids, lista.decodificarIds());
+    vector<int> out;
+    ListaPostings::Cursor cur(lista);
+    for (int x : ids) {
+        cur.avanzarHasta(x);
+        if (cur.fin() || cur.doc() != x) out.push_back(x);
+    }
+    return out;
+}
+
+/**
+ * @struct Conjunto
+ * @brief Resultado parcial de una consulta. Si `negado` es verdadero
+ *        representa el complemento de sus IDs, lo que permite resolver
+ *        "a AND NOT b" como una diferencia sin materializar el complemento.
+ *        Para un término solo se guarda un puntero a su lista de postings,
+ *        que se descomprime recién cuando hace falta.
+ */
+struct Conjunto {
+    vector<int> propio;
+    const ListaPostings* lista = nullptr;
+    bool negado = false;
+
+    size_t tamano() const { return lista ? lista->tamano() : propio.size(); }
+
+    /// IDs explícitos del conjunto (consume `propio`).
+    vector<int> tomarIds() { return lista ? lista->decodificarIds() : move(propio); }
+};
+
+/**
+ * @class ConsultaBooleana
+ * @brief Analizador descendente de consultas como
+ *        "parcial AND (noviembre OR octubre) NOT examen".
+ *
+ * Gramática (NOT tiene mayor precedencia que AND y AND mayor que OR; dos
+ * operandos seguidos sin operador se unen con AND):
+ *
+ *     o       := y ("OR" y)*
+ *     y       := factor (["AND"] factor)*
+ *     factor  := "NOT" factor | "(" o ")" | [campo:]palabra | [campo:]prefijo*
+ *              | "de:" dirección-o-dominio
+ *
+ * Las palabras se tokenizan igual que al indexar, por lo que "Cálculo-II"
+ * equivale a la conjunción de sus piezas. Los campos "asunto:" y "cuerpo:"
+ * limitan la palabra a esa parte del correo; "de:" busca una dirección de
+ * remitente completa o un dominio ("de:unal.edu.co" incluye los
+ * subdominios) y solo filtra, sin sumar al ranking.
+ *
+ * La consulta se evalúa segmento por segmento: como cada uno tiene un tramo
+ * de IDs propio, el resultado total es la concatenación de los parciales y
+ * el complemento de un NOT se toma dentro del tramo de cada segmento.
+ */
+class ConsultaBooleana {
+public:
+    /**
+     * @struct Evaluacion
+     * @brief Resultado de evaluar la consulta en un segmento.
+     */
+    struct Evaluacion {
+        vector<int> ids;   ///< Correos del segmento que cumplen la consulta
+        /// Listas no negadas (para el ranking), con la posición de su término en la consulta
+        vector<pair<size_t, const ListaPostings*>> positivos;
+        deque<ListaPostings> expansiones;   ///< Listas armadas (prefijos y "cuerpo:")
+    };
+
+private:
+    vector<string> tokens;
+    size_t pos = 0;
+    bool negando = false;                    ///< Si el factor actual está bajo un NOT
+    const Segmento* seg = nullptr;           ///< Segmento que se está evaluando
+    Evaluacion* ev = nullptr;
+
+    bool es(const char* tok) const { return pos < tokens.size() && tokens[pos] == tok; }
+
+    static Conjunto vacio() { return Conjunto(); }
+
+    /**
+     * @brief Resuelve una cadena de AND: intersecta los operandos positivos
+     *        de menor a mayor tamaño y luego resta cada uno de los negados.
+     */
+    static Conjunto combinarY(vector<Conjunto>& ops) {
+        if (ops.size() == 1) return move(ops[0]);
+
+        vector<Conjunto*> positivos, negativos;
+        for (Conjunto& op : ops)
+            (op.negado ? negativos : positivos).push_back(&op);
+
+        Conjunto res;
+        if (positivos.empty()) {
+            for (Conjunto* op : negativos)
+                res.propio = unir(res.propio, op->tomarIds());
+            res.negado = true;
+            return res;
+        }
+
+        // Solo se descomprime el operando más chico; los demás se recorren
+        // con cursores sobre sus listas cuando conviene
+        sort(positivos.begin(), positivos.end(), [](const Conjunto* x, const Conjunto* y) {
+            return x->tamano() < y->tamano();
+        });
+        res.propio = positivos[0]->tomarIds();
+        for (size_t i = 1; i < positivos.size() && !res.propio.empty(); i++) {
+            Conjunto& op = *positivos[i];
+            res.propio = op.lista ? intersectar(res.propio, *op.lista)
+                                  : intersectar(res.propio, op.propio);
+        }
+        for (size_t i = 0; i < negativos.size() && !res.propio.empty(); i++) {
+            Conjunto& op = *negativos[i];
+            res.propio = op.lista ? restar(res.propio, *op.lista)
+                                  : restar(res.propio, op.propio);
+        }
+        return res;
+    }
+
+    /**
+     * @brief OR entre dos conjuntos, posiblemente negados.
+     */
+    static Conjunto combinarO(Conjunto a, Conjunto b) {
+        Conjunto res;
+        if (!a.negado && !b.negado) {
+            res.propio = unir(a.tomarIds(), b.tomarIds());
+        } else if (a.negado && b.negado) {
+            res.propio = intersectar(a.tomarIds(), b.tomarIds());
+            res.negado = true;
+        } else {
+            Conjunto& neg = a.negado ? a : b;
+            Conjunto& pos = a.negado ? b : a;
+            res.propio = restar(neg.tomarIds(), pos.tomarIds());
+            res.negado = true;
+        }
+        return res;
+    }
+
+    Conjunto expresionO() {
+        Conjunto res = expresionY();
+        while (es("OR")) {
+            pos++;
+            res = combinarO(res, expresionY());
+        }
+        return res;
+    }
+
+    Conjunto expresionY() {
+        vector<Conjunto> ops;
+        ops.push_back(factor());
+        while (pos < tokens.size() && !es("OR") && !es(")")) {
+            if (es("AND")) pos++;
+            ops.push_back(factor());
+        }
+        return combinarY(ops);
+    }
+
+    Conjunto factor() {
+        if (pos >= tokens.size()) return vacio();
+        if (es("NOT")) {
+            pos++;
+            negando = !negando;
+            Conjunto res = factor();
+            negando = !negando;
+            res.negado = !res.negado;
+            return res;
+        }
+        if (es("(")) {
+            pos++;
+            Conjunto res = expresionO();
+            if (es(")")) pos++;
+            return res;
+        }
+        if (es(")") || es("AND") || es("OR")) {
+            pos++;
+            return vacio();
+        }
+        Conjunto res;
+        size_t posTermino = pos;
+        const string& token = tokens[pos++];
+        size_t dosPuntos = token.find(':');
+        string_view campo = dosPuntos == string::npos ? string_view() : string_view(token).substr(0, dosPuntos);
+        string termino = token.substr(dosPuntos == string::npos ? 0 : dosPuntos + 1);
+
+        if (campo == "de") {
+            res.lista = seg->remitente.buscar(termino);
+            return res;
+        }
+        const ListaPostings* lista = campo == "cuerpo" ? &listaCuerpo(termino)
+                                     : listaCampo(campo == "asunto" ? seg->asunto : seg->texto, termino);
+        if (lista && !lista->vacia()) {
+            res.lista = lista;
+            if (!negando) ev->positivos.push_back({posTermino, lista});
+        }
+        return res;
+    }
+
+    /**
+     * @brief Arma una lista en `expansiones` a partir de pares (ID,
+     *        frecuencia) desordenados, sumando las frecuencias de un mismo ID.
+     */
+    ListaPostings& armarLista(vector<pair<int, int>>& pares) {
+        sort(pares.begin(), pares.end());
+        ListaPostings& lista = ev->expansiones.emplace_back();
+        for (size_t i = 0; i < pares.size();) {
+            int id = pares[i].first, frecuencia = 0;
+            for (; i < pares.size() && pares[i].first == id; i++) frecuencia += pares[i].second;
+            lista.agregar(id, frecuencia);
+        }
+        return lista;
+    }
+
+    /**
+     * @brief IDs en `indice` de los términos que calzan con una palabra o,
+     *        si termina en '*', con un prefijo.
+     */
+    static vector<int> terminosQueCalzan(const IndiceCampo& indice, const string& termino) {
+        if (termino.back() == '*')
+            return indice.diccionario.conPrefijo(string_view(termino.data(), termino.size() - 1));
+        int id = indice.terminos.buscar(termino);
+        return id < 0 ? vector<int>() : vector<int>{id};
+    }
+
+    /**
+     * @brief Lista de una palabra en un índice, o nullptr si no está. Para
+     *        un prefijo se fusionan las listas de todos los términos que lo
+     *        tienen, sumando frecuencias, y para el ranking cuenta como un
+     *        único término.
+     */
+    const ListaPostings* listaCampo(const IndiceCampo& indice, const string& termino) {
+        if (termino.back() != '*') return indice.buscar(termino);
+        vector<pair<int, int>> pares;
+        for (int t : terminosQueCalzan(indice, termino))
+            for (ListaPostings::Cursor cur(indice.postings[t]); !cur.fin(); cur.siguiente())
+                pares.push_back({cur.doc(), cur.frecuencia()});
+        return &armarLista(pares);
+    }
+
+    /**
+     * @brief Lista de una palabra (o prefijo) en el cuerpo: las
+     *        frecuencias del texto completo menos las del asunto.
+     */
+    const ListaPostings& listaCuerpo(const string& termino) {
+        vector<pair<int, int>> pares;
+        for (int t : terminosQueCalzan(seg->texto, termino)) {
+            const ListaPostings* enAsunto = seg->asunto.buscar(seg->texto.terminos.texto(t));
+            optional<ListaPostings::Cursor> asu;
+            if (enAsunto) asu.emplace(*enAsunto);
+            for (ListaPostings::Cursor cur(seg->texto.postings[t]); !cur.fin(); cur.siguiente()) {
+                int frecuencia = cur.frecuencia();
+                if (asu) {
+                    asu->avanzarHasta(cur.doc());
+                    if (!asu->fin() && asu->doc() == cur.doc()) frecuencia -= asu->frecuencia();
+                }
+                if (frecuencia > 0) pares.push_back({cur.doc(), frecuencia});
+            }
+        }
+        return armarLista(pares);
+    }
+
+    /**
+     * @brief Forma de búsqueda de un prefijo: si el análisis solo le recorta
+     *        el final ("entrega" -> "entreg") se usa la forma recortada, que
+     *        también encuentra los términos lematizados; si no, el prefijo
+     *        queda tal cual (las palabras vacías no se descartan aquí).
+     */
+    static string prefijoAnalizado(const string& p) {
+        string a = p;
+        if (analizadorTerminos.procesar(a) && p.compare(0, a.size(), a) == 0) return a;
+        return p;
+    }
+
+    /**
+     * @brief Quita los operadores que quedaron sin operando al descartar
+     *        palabras vacías ("parcial AND de" -> "parcial") y los
+     *        paréntesis vacíos.
+     */
+    void quitarOperadoresHuerfanos() {
+        auto binario = [](const string& t) { return t == "AND" || t == "OR"; };
+        bool cambio = true;
+        while (cambio) {
+            cambio = false;
+            vector<string> out;
+            for (size_t i = 0; i < tokens.size(); i++) {
+                const string& t = tokens[i];
+                bool antesAbre = out.empty() || out.back() == "(" || out.back() == "NOT" ||
+                                 binario(out.back());
+                bool despuesCierra = i + 1 == tokens.size() || tokens[i + 1] == ")" ||
+                                     binario(tokens[i + 1]);
+                if ((binario(t) && (antesAbre || despuesCierra)) ||
+                    (t == "NOT" && despuesCierra) ||
+                    (t == "(" && i + 1 < tokens.size() && tokens[i + 1] == ")")) {
+                    if (t == "(") i++;
+                    cambio = true;
+                    continue;
+                }
+                out.push_back(t);
+            }
+            tokens = move(out);
+        }
+    }
+
+    /**
+     * @brief Campo con el que empieza una pieza de la consulta ("asunto",
+     *        "cuerpo" o "de", sin distinguir mayúsculas), o vacío.
+     */
+    static string campoDe(string_view pieza) {
+        size_t dosPuntos = pieza.find(':');
+        if (dosPuntos == string_view::npos) return "";
+        string campo(pieza.substr(0, dosPuntos));
+        for (char& ch : campo) ch = tolower((unsigned char)ch);
+        return (campo == "asunto" || campo == "cuerpo" || campo == "de") ? campo : "";
+    }
+
+public:
+    /**
+     * @brief Separa la consulta en operadores (AND, OR, NOT en mayúsculas),
+     *        paréntesis y términos, que llevan delante su campo si tienen.
+     */
+    explicit ConsultaBooleana(string_view texto) {
+        size_t i = 0;
+        while (i < texto.size()) {
+            char ch = texto[i];
+            if (ch == '(' || ch == ')') {
+                tokens.push_back(string(1, ch));
+                i++;
+                continue;
+            }
+            if (isspace((unsigned char)ch)) {
+                i++;
+                continue;
+            }
+            size_t fin = i;
+            while (fin < texto.size() && !isspace((unsigned char)texto[fin]) &&
+                   texto[fin] != '(' && texto[fin] != ')')
+                fin++;
+            string_view pieza = texto.substr(i, fin - i);
+            string campo = campoDe(pieza);
+            if (pieza == "AND" || pieza == "OR" || pieza == "NOT") {
+                tokens.push_back(string(pieza));
+            } else if (campo == "de") {
+                // La dirección o el dominio se normalizan como al indexar
+                string valor = normalizarRemitente(pieza.substr(3));
+                if (!valor.empty() && valor[0] == '@') valor.erase(0, 1);
+                tokens.push_back("de:" + valor);
+            } else {
+                if (!campo.empty()) pieza.remove_prefix(campo.size() + 1);
+                string marca = campo.empty() ? "" : campo + ":";
+                // Una pieza con varias palabras se agrupa como conjunción;
+                // un '*' final convierte a la última palabra en prefijo. Las
+                // palabras pasan por el mismo análisis que al indexar
+                bool prefijo = !pieza.empty() && pieza.back() == '*';
+                vector<string> palabras, analizadas;
+                Tokenizador().separar(pieza, [&](string& p) { palabras.push_back(p); });
+                for (size_t k = 0; k < palabras.size(); k++) {
+                    if (prefijo && k + 1 == palabras.size())
+                        analizadas.push_back(marca + prefijoAnalizado(palabras[k]) + '*');
+                    else if (analizadorTerminos.procesar(palabras[k]))
+                        analizadas.push_back(marca + palabras[k]);
+                }
+                if (analizadas.size() > 1) tokens.push_back("(");
+                for (string& p : analizadas) tokens.push_back(move(p));
+                if (analizadas.size() > 1) tokens.push_back(")");
+            }
+            i = fin;
+        }
+        quitarOperadoresHuerfanos();
+    }
+
+    /**
+     * @brief Forma normalizada de la consulta: sus piezas ya analizadas,
+     *        separadas por espacios. Dos textos con la misma clave dan
+     *        siempre el mismo resultado.
+     */
+    string clave() const {
+        string out;
+        for (const string& t : tokens) {
+            if (!out.empty()) out += ' ';
+            out += t;
+        }
+        return out;
+    }
+
+    /**
+     * @brief Términos de la consulta sin campo (sin operadores, prefijos ni
+     *        palabras con "campo:").
+     */
+    vector<string> terminos() const {
+        vector<string> out;
+        for (const string& t : tokens)
+            if (t != "(" && t != ")" && t != "AND" && t != "OR" && t != "NOT" && t.back() != '*' &&
+                t.find(':') == string::npos)
+                out.push_back(t);
+        return out;
+    }
+
+    /**
+     * @brief Indica si la consulta es una disyunción de términos simples
+     *        ("a", "a OR b OR c"), que puede rankearse sin evaluarla.
+     */
+    bool esDisyuncion() const {
+        if (tokens.empty()) return false;
+        for (size_t i = 0; i < tokens.size(); i++) {
+            const string& t = tokens[i];
+            bool operador = (t == "(" || t == ")" || t == "AND" || t == "NOT" || t == "OR");
+            bool simple = !operador && t.back() != '*' && t.find(':') == string::npos;
+            if (i % 2 == 0 ? !simple : t != "OR") return false;
+        }
+        return tokens.size() % 2 == 1;
+    }
+
+    /**
+     * @brief Evalúa la consulta en un segmento, sin los correos de
+     *        `borrados` (que puede ser nulo). Las listas de `positivos` viven
+     *        mientras vivan el segmento y la evaluación.
+     */
+    Evaluacion evaluar(const Segmento& s, const MapaBorrados* borrados = nullptr) {
+        Evaluacion res;
+        if (tokens.empty()) return res;
+        pos = 0;
+        negando = false;
+        seg = &s;
+        ev = &res;
+        Conjunto c = expresionO();
+        if (!c.negado) {
+            res.ids = c.tomarIds();
+        } else {
+            // Complemento respecto de los correos del segmento
+            vector<int> todos(s.nCorreos);
+            for (int i = 0; i < s.nCorreos; i++) todos[i] = s.primerId + i;
+            res.ids = c.lista ? restar(todos, *c.lista) : restar(todos, c.propio);
+        }
+        if (borrados)
+            res.ids.erase(remove_if(res.ids.begin(), res.ids.end(),
+                                    [borrados](int id) { return borrados->contiene(id); }),
+                          res.ids.end());
+        seg = nullptr;
+        ev = nullptr;
+        return res;
+    }
+
+    /**
+     * @brief Evalúa la consulta en todos los segmentos de la vista.
+     * @return IDs de los correos que la cumplen, en orden creciente.
+     */
+    vector<int> evaluar(const VistaIndice& vista) {
+        vector<int> out;
+        for (size_t i = 0; i < vista.segmentos.size(); i++) {
+            vector<int> ids = evaluar(*vista.segmentos[i], vista.borrados[i].get()).ids;
+            out.insert(out.end(), ids.begin(), ids.end());
+        }
+        return out;
+    }
+};
+
+// ============================================================================
+// RELEVANCIA BM25 CON TOP-K
+// ============================================================================
+/*
+ * Cada correo recibe, por cada término t de la consulta,
+ *
+ *     idf(t) * tf * (k1 + 1) / (tf + k1 * (1 - b + b * long / longMedia))
+ *
+ * con idf(t) = ln(1 + (N - df + 0.5) / (df + 0.5)). Solo se guardan los K
+ * mejores en un montículo de mínimos; su mínimo es el umbral que hay que
+ * superar para entrar.
+ *
+ * Para disyunciones se usa MaxScore: cada término tiene una cota superior
+ * de su aporte (con su frecuencia máxima y longitud cero). Los términos
+ * cuyas cotas sumadas no alcanzan el umbral son "no esenciales": un correo
+ * que solo los contenga no puede entrar al top-K, así que los candidatos se
+ * toman de las listas esenciales y las demás solo se consultan (galopando)
+ * mientras el puntaje parcial más las cotas restantes pueda superar el
+ * umbral.
+ *
+ * Los correos borrados no se ofrecen al montículo, pero siguen contando en
+ * N, df y la longitud media hasta que una fusión los descarta del segmento.
+ */
+
+const double BM25_K1 = 1.2;
+const double BM25_B = 0.75;
+
+/// Cantidad de resultados que devuelve el ranking.
+const size_t TAM_RANKING = TAM_PAGINA;
+
+/**
+ * @struct ResultadoRanking
+ * @brief Un correo con su puntaje BM25.
+ */
+struct ResultadoRanking {
+    int id;
+    double puntaje;
+};
+
+/**
+ * @struct TerminoRanking
+ * @brief Lista de postings de un término en un segmento, con su idf global.
+ */
+struct TerminoRanking {
+    const ListaPostings* lista;
+    double idf;
+};
+
+/**
+ * @class RankingBM25
+ * @brief Calcula los K correos más relevantes de una vista. Los segmentos
+ *        se rankean uno a la vez sobre el mismo montículo, de modo que el
+ *        umbral que alcanza un segmento ya poda en los siguientes. N, la
+ *        longitud media y los idf son los de la vista completa, así que los
+ *        puntajes no dependen de cómo estén repartidos los segmentos.
+ */
+class RankingBM25 {
+private:
+    struct CursorTermino {
+        ListaPostings::Cursor cur;
+        double idf = 0;
+        double cota = 0;
+
+        explicit CursorTermino(const ListaPostings& lista) : cur(lista) {}
+    };
+
+    /**
+     * @brief Montículo de los K mejores; la cima es el peor de ellos.
+     */
+    struct TopK {
+        size_t k;
+        vector<pair<double, int>> monticulo;   // (puntaje, -id)
+
+        explicit TopK(size_t k) : k(k) {}
+
+        /// Puntaje que hay que superar para entrar (infinito si k = 0).
+        double umbral() const {
+            if (k == 0) return HUGE_VAL;
+            return monticulo.size() < k ? 0 : monticulo.front().first;
+        }
+
+        void ofrecer(int id, double puntaje) {
+            pair<double, int> e = {puntaje, -id};
+            auto mayor = greater<pair<double, int>>();
+            if (monticulo.size() < k) {
+                monticulo.push_back(e);
+                push_heap(monticulo.begin(), monticulo.end(), mayor);
+            } else if (k > 0 && e > monticulo.front()) {
+                pop_heap(monticulo.begin(), monticulo.end(), mayor);
+                monticulo.back() = e;
+                push_heap(monticulo.begin(), monticulo.end(), mayor);
+            }
+        }
+
+        vector<ResultadoRanking> ordenados() {
+            sort(monticulo.begin(), monticulo.end(), greater<pair<double, int>>());
+            vector<ResultadoRanking> out;
+            for (auto [puntaje, menosId] : monticulo) out.push_back({-menosId, puntaje});
+            return out;
+        }
+    };
+
+    TopK top;
+    double n = 0;
+    double longMedia = 1;
+
+    double aporte(const CursorTermino& c, const Segmento& s, int id) const {
+        double tf = c.cur.frecuencia();
+        double norma = 1 - BM25_B + BM25_B * s.longitud(id) / longMedia;
+        return c.idf * tf * (BM25_K1 + 1) / (tf + BM25_K1 * norma);
+    }
+
+    /**
+     * @brief Un cursor por lista distinta y no vacía; cada lista cuenta
+     *        como un término.
+     */
+    static vector<CursorTermino> cursoresDe(vector<TerminoRanking> terminos) {
+        sort(terminos.begin(), terminos.end(), [](const TerminoRanking& a, const TerminoRanking& b) {
+            return a.lista < b.lista;
+        });
+        vector<CursorTermino> cursores;
+        for (size_t i = 0; i < terminos.size(); i++) {
+            const ListaPostings* lista = terminos[i].lista;
+            if (lista->vacia() || (i && lista == terminos[i - 1].lista)) continue;
+            CursorTermino c(*lista);
+            c.idf = terminos[i].idf;
+            double tf = lista->maxFrecuencia();
+            c.cota = c.idf * tf * (BM25_K1 + 1) / (tf + BM25_K1 * (1 - BM25_B));
+            cursores.push_back(c);
+        }
+        return cursores;
+    }
+
+public:
+    RankingBM25(const VistaIndice& vista, size_t k) : top(k), n(vista.nCorreos) {
+        if (n > 0) longMedia = max(1.0, vista.totalTerminos / n);
+    }
+
+    /**
+     * @brief idf de un término que aparece en `df` correos de la vista.
+     */
+    double idf(size_t df) const {
+        return log(1 + (n - df + 0.5) / (df + 0.5));
+    }
+
+    /**
+     * @brief Rankea la disyunción de los términos dentro de un segmento,
+     *        con poda MaxScore y sin los correos de `borrados` (puede ser
+     *        nulo).
+     */
+    void disyuncion(const Segmento& s, vector<TerminoRanking> terminos,
+                    const MapaBorrados* borrados = nullptr) {
+        vector<CursorTermino> cursores = cursoresDe(move(terminos));
+        size_t nc = cursores.size();
+        sort(cursores.begin(), cursores.end(), [](const CursorTermino& a, const CursorTermino& b) {
+            return a.cota < b.cota;
+        });
+        vector<double> acumulada(nc);
+        for (size_t i = 0; i < nc; i++)
+            acumulada[i] = cursores[i].cota + (i ? acumulada[i - 1] : 0);
+
+        // Las listas [0, primerEsencial) son no esenciales
+        size_t primerEsencial = 0;
+        while (primerEsencial < nc && acumulada[primerEsencial] < top.umbral())
+            primerEsencial++;
+        while (true) {
+            int d = INT_MAX;
+            for (size_t i = primerEsencial; i < nc; i++)
+                if (!cursores[i].cur.fin()) d = min(d, cursores[i].cur.doc());
+            if (d == INT_MAX) break;
+            if (estaBorrado(borrados, d)) {
+                for (size_t i = primerEsencial; i < nc; i++)
+                    if (!cursores[i].cur.fin() && cursores[i].cur.doc() == d) cursores[i].cur.siguiente();
+                continue;
+            }
+
+            double puntaje = 0;
+            for (size_t i = primerEsencial; i < nc; i++) {
+                CursorTermino& c = cursores[i];
+                if (!c.cur.fin() && c.cur.doc() == d) {
+                    puntaje += aporte(c, s, d);
+                    c.cur.siguiente();
+                }
+            }
+            for (size_t i = primerEsencial; i-- > 0;) {
+                if (puntaje + acumulada[i] < top.umbral()) break;
+                CursorTermino& c = cursores[i];
+                c.cur.avanzarHasta(d);
+                if (!c.cur.fin() && c.cur.doc() == d) puntaje += aporte(c, s, d);
+            }
+
+            top.ofrecer(d, puntaje);
+            while (primerEsencial < nc && acumulada[primerEsencial] < top.umbral())
+                primerEsencial++;
+        }
+    }
+
+    /**
+     * @brief Rankea los `candidatos` (ordenados) de un segmento, por ejemplo
+     *        el resultado de una consulta booleana. Deja de sumar aportes de
+     *        un correo en cuanto ya no puede superar el umbral.
+     */
+    void entre(const Segmento& s, vector<TerminoRanking> terminos, const vector<int>& candidatos) {
+        vector<CursorTermino> cursores = cursoresDe(move(terminos));
+        sort(cursores.begin(), cursores.end(), [](const CursorTermino& a, const CursorTermino& b) {
+            return a.cota > b.cota;
+        });
+        vector<double> restante(cursores.size() + 1, 0);
+        for (size_t i = cursores.size(); i-- > 0;)
+            restante[i] = restante[i + 1] + cursores[i].cota;
+
+        for (int d : candidatos) {
+            double puntaje = 0;
+            for (size_t i = 0; i < cursores.size(); i++) {
+                if (puntaje + restante[i] < top.umbral()) break;
+                CursorTermino& c = cursores[i];
+                c.cur.avanzarHasta(d);
+                if (!c.cur.fin() && c.cur.doc() == d) puntaje += aporte(c, s, d);
+            }
+            top.ofrecer(d, puntaje);
+        }
+    }
+
+    /**
+     * @brief Los K mejores de todo lo rankeado, de mayor a menor puntaje.
+     */
+    vector<ResultadoRanking> resultados() { return top.ordenados(); }
+};
+
+/**
+ * @brief Cantidad de correos de un segmento que están en alguna de las
+ *        listas, sin los de `borrados` (puede ser nulo). Con una sola lista
+ *        solo se buscan en ella los borrados.
+ */
+size_t contarUnion(const vector<const ListaPostings*>& listas, const MapaBorrados* borrados) {
+    if (listas.size() == 1) {
+        size_t n = listas[0]->tamano();
+        if (borrados && n > 0) {
+            ListaPostings::Cursor cur(*listas[0]);
+            borrados->recorrer([&](int id) {
+                cur.avanzarHasta(id);
+                if (!cur.fin() && cur.doc() == id) n--;
+            });
+        }
+        return n;
+    }
+    vector<ListaPostings::Cursor> cursores;
+    for (const ListaPostings* lista : listas) cursores.emplace_back(*lista);
+    size_t n = 0;
+    while (true) {
+        int d = INT_MAX;
+        for (const auto& c : cursores)
+            if (!c.fin()) d = min(d, c.doc());
+        if (d == INT_MAX) return n;
+        if (!estaBorrado(borrados, d)) n++;
+        for (auto& c : cursores)
+            if (!c.fin() && c.doc() == d) c.siguiente();
+    }
+}
+
+/**
+ * @brief Los `k` correos de la vista más relevantes para una consulta. Las
+ *        disyunciones simples se rankean directamente sobre las listas; el
+ *        resto se evalúa y luego se rankea el conjunto resultante.
+ * @param total Recibe la cantidad de coincidencias. En las disyunciones,
+ *        cuyo ranking poda y no las recorre completas, es el mayor df de
+ *        sus términos: exacto para un término sin borrados pendientes y
+ *        aproximado en otro caso (contarCoincidencias() da el exacto).
+ * @param aproximado Recibe si `total` es aproximado.
+ */
+vector<ResultadoRanking> buscarRelevantes(const VistaIndice& vista, ConsultaBooleana& q,
+                                          size_t k, size_t& total, bool& aproximado) {
+    RankingBM25 ranking(vista, k);
+    total = 0;
+    aproximado = false;
+
+    if (q.esDisyuncion()) {
+        vector<string> terminos = q.terminos();
+        vector<size_t> df(terminos.size(), 0);
+        for (const auto& s : vista.segmentos)
+            for (size_t i = 0; i < terminos.size(); i++)
+                if (const ListaPostings* lista = s->buscarPostings(terminos[i]))
+                    df[i] += lista->tamano();
+        for (size_t j = 0; j < vista.segmentos.size(); j++) {
+            vector<TerminoRanking> listas;
+            for (size_t i = 0; i < terminos.size(); i++)
+                if (const ListaPostings* lista = vista.segmentos[j]->buscarPostings(terminos[i]))
+                    listas.push_back({lista, ranking.idf(df[i])});
+            ranking.disyuncion(*vista.segmentos[j], move(listas), vista.borrados[j].get());
+            if (vista.borradosPendientes(j) > 0) aproximado = true;
+        }
+        if (!df.empty()) total = *max_element(df.begin(), df.end());
+        if (terminos.size() > 1) aproximado = true;
+        return ranking.resultados();
+    }
+
+    // El df de cada término (o prefijo) de la consulta suma los de todos
+    // los segmentos, así que primero se evalúan todos
+    vector<ConsultaBooleana::Evaluacion> evaluaciones;
+    evaluaciones.reserve(vista.segmentos.size());
+    unordered_map<size_t, size_t> df;
+    for (size_t i = 0; i < vista.segmentos.size(); i++) {
+        evaluaciones.push_back(q.evaluar(*vista.segmentos[i], vista.borrados[i].get()));
+        total += evaluaciones.back().ids.size();
+        for (auto [posTermino, lista] : evaluaciones.back().positivos)
+            df[posTermino] += lista->tamano();
+    }
+    for (size_t i = 0; i < evaluaciones.size(); i++) {
+        vector<TerminoRanking> listas;
+        for (auto [posTermino, lista] : evaluaciones[i].positivos)
+            listas.push_back({lista, ranking.idf(df[posTermino])});
+        ranking.entre(*vista.segmentos[i], move(listas), evaluaciones[i].ids);
+    }
+    return ranking.resultados();
+}
+
+/**
+ * @brief Cantidad exacta de correos de la vista que cumplen la consulta.
+ *        En las disyunciones recorre todas las listas de sus términos, así
+ *        que solo se usa cuando hace falta el total exacto.
+ */
+size_t contarCoincidencias(const VistaIndice& vista, ConsultaBooleana& q) {
+    size_t total = 0;
+    if (q.esDisyuncion()) {
+        vector<string> terminos = q.terminos();
+        for (size_t j = 0; j < vista.segmentos.size(); j++) {
+            vector<const ListaPostings*> listas;
+            for (const string& t : terminos) {
+                const ListaPostings* lista = vista.segmentos[j]->buscarPostings(t);
+                if (lista && find(listas.begin(), listas.end(), lista) == listas.end())
+                    listas.push_back(lista);
+            }
+            if (!listas.empty()) total += contarUnion(listas, vista.borrados[j].get());
+        }
+        return total;
+    }
+    for (size_t j = 0; j < vista.segmentos.size(); j++)
+        total += q.evaluar(*vista.segmentos[j], vista.borrados[j].get()).ids.size();
+    return total;
+}
+
+// ============================================================================
+// CACHÉ DE CONSULTAS
+// ============================================================================
+/// Bytes de resultados que guarda la caché de consultas.
+const size_t CAPACIDAD_CACHE_CONSULTAS = 8 << 20;
+
+/**
+ * @struct ResultadoConsulta
+ * @brief Resultado de una búsqueda: los correos en el orden en que se
+ *        muestran (con puntaje 0 si la búsqueda no rankea) y el total de
+ *        coincidencias que informa buscarRelevantes.
+ */
+struct ResultadoConsulta {
+    vector<ResultadoRanking> resultados;
+    size_t total = 0;
+    bool totalAproximado = false;
+};
+
+/**
+ * @class CacheConsultas
+ * @brief Caché LRU de resultados de búsqueda por consulta normalizada,
+ *        acotada en bytes.
+ *
+ * Cada entrada recuerda la generación de la vista con que se calculó y solo
+ * se usa con esa misma vista. Publicar correos nuevos, borrar, editar o
+ * fusionar segmentos publica otra generación, así que las entradas viejas
+ * dejan de servir solas y se reemplazan al volver a calcularse; la caché
+ * nunca devuelve algo distinto de lo que daría la búsqueda. Es segura entre
+ * hilos y el candado solo cubre buscar y guardar, no el cálculo.
+ */
+class CacheConsultas {
+private:
+    struct Entrada {
+        string clave;
+        uint64_t generacion;
+        shared_ptr<const ResultadoConsulta> resultado;
+    };
+
+    size_t capacidad;
+    mutex m;
+    list<Entrada> recientes;   ///< La más reciente al frente
+    unordered_map<string_view, list<Entrada>::iterator> porClave;   ///< Claves de `recientes`
+    size_t bytes = 0;
+    atomic<uint64_t> nAciertos{0}, nFallos{0};
+
+    static size_t bytesDe(const Entrada& e) {
+        return e.clave.size() + e.resultado->resultados.size() * sizeof(ResultadoRanking) +
+               sizeof(Entrada);
+    }
+
+    void quitar(list<Entrada>::iterator it) {
+        bytes -= bytesDe(*it);
+        porClave.erase(it->clave);
+        recientes.erase(it);
+    }
+
+public:
+    explicit CacheConsultas(size_t capacidad) : capacidad(capacidad) {}
+
+    /**
+     * @brief Resultado guardado para la clave, o nullptr si no hay uno
+     *        calculado con la vista de esta generación.
+     */
+    shared_ptr<const ResultadoConsulta> buscar(const string& clave, uint64_t generacion) {
+        lock_guard<mutex> bloqueo(m);
+        auto it = porClave.find(clave);
+        if (it == porClave.end() || it->second->generacion != generacion) {
+            nFallos.fetch_add(1, memory_order_relaxed);
+            return nullptr;
+        }
+        nAciertos.fetch_add(1, memory_order_relaxed);
+        recientes.splice(recientes.begin(), recientes, it->second);
+        return it->second->resultado;
+    }
+
+    uint64_t aciertos() const { return nAciertos.load(memory_order_relaxed); }
+    uint64_t fallos() const { return nFallos.load(memory_order_relaxed); }
+
+    /// Entradas y bytes guardados.
+    pair<size_t, size_t> ocupacion() {
+        lock_guard<mutex> bloqueo(m);
+        return {recientes.size(), bytes};
+    }
+
+    /**
+     * @brief Guarda un resultado, salvo que ya haya uno de una generación
+     *        más nueva (de un lector que usa una vista más reciente).
+     */
+    void guardar(const string& clave, uint64_t generacion,
+                 shared_ptr<const ResultadoConsulta> resultado) {
+        Entrada nueva{clave, generacion, move(resultado)};
+        if (bytesDe(nueva) > capacidad / 8) return;
+
+        lock_guard<mutex> bloqueo(m);
+        auto it = porClave.find(clave);
+        if (it != porClave.end()) {
+            if (it->second->generacion > generacion) return;
+            quitar(it->second);
+        }
+        recientes.push_front(move(nueva));
+        porClave[recientes.front().clave] = recientes.begin();
+        bytes += bytesDe(recientes.front());
+        while (bytes > capacidad) quitar(prev(recientes.end()));
+    }
+};
+
+CacheConsultas cacheConsultas(CAPACIDAD_CACHE_CONSULTAS);
+
+/**
+ * @brief buscarRelevantes a través de la caché de consultas.
+ */
+shared_ptr<const ResultadoConsulta> relevantesEnCache(const VistaIndice& vista,
+                                                      ConsultaBooleana& q, size_t k) {
+    string clave = "texto " + to_string(k) + " " + q.clave();
+    if (auto guardado = cacheConsultas.buscar(clave, vista.generacion)) return guardado;
+    auto res = make_shared<ResultadoConsulta>();
+    res->resultados = buscarRelevantes(vista, q, k, res->total, res->totalAproximado);
+    cacheConsultas.guardar(clave, vista.generacion, res);
+    return res;
+}
+
+/**
+ * @brief correosDeRemitentes a través de la caché de consultas, con los IDs
+ *        en orden de fecha.
+ */
+shared_ptr<const ResultadoConsulta> remitentesEnCache(const VistaIndice& vista,
+                                                      string_view patron) {
+    string clave = "de " + normalizarRemitente(patron);
+    if (auto guardado = cacheConsultas.buscar(clave, vista.generacion)) return guardado;
+    auto res = make_shared<ResultadoConsulta>();
+    for (const Correo* c : correosDeRemitentes(vista, patron)) res->resultados.push_back({c->id, 0});
+    res->total = res->resultados.size();
+    cacheConsultas.guardar(clave, vista.generacion, res);
+    return res;
+}
+
+// ============================================================================
+// LEER ARCHIVO TXT
+// ============================================================================
+/**
+ * @class ArchivoMapeado
+ * @brief Proyecta un archivo completo en memoria de solo lectura.
+ *
+ * En POSIX usa mmap, de modo que el contenido se lee directamente de la
+ * caché de páginas del sistema sin copias intermedias. En Windows se lee
+ * el archivo completo con una sola operación de lectura.
+ */
+class ArchivoMapeado {
+private:
+    const char* datos = nullptr;
+    size_t tam = 0;
+    bool ok = false;
+#ifdef _WIN32
+    string buffer;
+#endif
+
+public:
+    explicit ArchivoMapeado(const string& nombre) {
+#ifdef _WIN32
+        ifstream file(nombre, ios::binary);
+        if (!file.is_open()) return;
+        buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        datos = buffer.data();
+        tam = buffer.size();
+        ok = true;
+#else
+        int fd = open(nombre.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) == 0) {
+            tam = (size_t)st.st_size;
+            if (tam == 0) {
+                ok = true;
+            } else {
+                void* p = mmap(nullptr, tam, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p != MAP_FAILED) {
+                    madvise(p, tam, MADV_SEQUENTIAL);
+                    datos = (const char*)p;
+                    ok = true;
+                }
+            }
+        }
+        close(fd);
+#endif
+    }
+
+    ~ArchivoMapeado() {
+#ifndef _WIN32
+        if (datos) munmap((void*)datos, tam);
+#endif
+    }
+
+    ArchivoMapeado(const ArchivoMapeado&) = delete;
+    ArchivoMapeado& operator=(const ArchivoMapeado&) = delete;
+
+    bool abierto() const { return ok; }
+
+    string_view contenido() const { return string_view(datos, tam); }
+};
+
+/**
+ * @brief Extrae de `resto` el texto hasta el primer `sep` (sin incluirlo)
+ *        y avanza `resto` justo después del separador. No copia nada.
+ */
+string_view cortarCampo(string_view& resto, char sep) {
+    size_t pos = resto.find(sep);
+    string_view campo = resto.substr(0, pos);
+    resto = (pos == string_view::npos) ? string_view() : resto.substr(pos + 1);
+    return campo;
+}
+
+/**
+ * @struct CamposCorreo
+ * @brief Campos de un registro del archivo, como vistas sobre el archivo.
+ */
+struct CamposCorreo {
+    string_view rem, asu, cue, fec;
+    Fecha fecha;   ///< `fec` ya leída
+};
+
+/**
+ * @brief Estado de la lectura de un registro.
+ */
+enum EstadoRegistro {
+    REGISTRO_VALIDO,    ///< Los campos quedaron en `campos`.
+    REGISTRO_VACIO,     ///< Línea en blanco; se ignora sin reportar.
+    REGISTRO_INVALIDO   ///< Registro mal formado; se omite y se reporta.
+};
+
+/**
+ * @class LectorRegistros
+ * @brief Analizador incremental de registros sobre un bloque en memoria.
+ *
+ * Acepta dos formatos, que pueden mezclarse en el mismo archivo:
+ *
+ *  - Formato clásico, una línea por correo:
+ *        remitente;asunto;cuerpo;fecha
+ *    El remitente y el asunto van hasta el primer y segundo ';', la fecha
+ *    es lo que sigue al último ';' y el cuerpo es todo lo intermedio, por
+ *    lo que el cuerpo puede contener ';'.
+ *
+ *  - Formato con longitudes, para texto arbitrario (incluye ';' y saltos
+ *    de línea):
+ *        #<bytes rem> <bytes asu> <bytes cue> <bytes fec>\n
+ *        <rem><asu><cue><fec>\n
+ *    Los campos se ubican por su longitud, sin examinar cada carácter.
+ *
+ * En ambos casos la fecha debe tener la forma AAAA-MM-DD, con un mes y un
+ * día posibles; si no, el registro se considera mal formado. Los campos son
+ * vistas sobre el bloque, y la fecha se entrega además ya empaquetada.
+ *
+ * El diario intercala además marcas de borrado, "-<id> <huella>\n", que
+ * se leen con leerBorrado(). La huella (ver huellaCorreo()) falta en las
+ * marcas de diarios anteriores a ella.
+ */
+class LectorRegistros {
+private:
+    string_view resto;
+
+    EstadoRegistro leerClasico(CamposCorreo& campos) {
+        string_view linea = recortar(cortarCampo(resto, '\n'));
+        if (linea.empty()) return REGISTRO_VACIO;
+
+        size_t p1 = linea.find(';');
+        size_t p2 = (p1 == string_view::npos) ? p1 : linea.find(';', p1 + 1);
+        size_t p3 = linea.rfind(';');
+        if (p2 == string_view::npos || p3 == p2) return REGISTRO_INVALIDO;
+
+        campos.rem = linea.substr(0, p1);
+        campos.asu = linea.substr(p1 + 1, p2 - p1 - 1);
+        campos.cue = linea.substr(p2 + 1, p3 - p2 - 1);
+        campos.fec = recortar(linea.substr(p3 + 1));
+        return REGISTRO_VALIDO;
+    }
+
+    /**
+     * @brief Tras una cabecera ilegible, avanza hasta la próxima línea que
+     *        empieza con '#' o que es un registro clásico válido, para no
+     *        tomar el contenido del registro roto como registros clásicos.
+     */
+    void resincronizar() {
+        while (!resto.empty() && resto[0] != '#') {
+            string_view linea = resto;
+            CamposCorreo campos;
+            if (leerClasico(campos) == REGISTRO_VALIDO && !campos.rem.empty() &&
+                leerFecha(campos.fec, campos.fecha)) {
+                resto = linea;
+                return;
+            }
+        }
+    }
+
+    /**
+     * @brief Lee las cuatro longitudes de una cabecera "#a b c d" y su suma
+     *        `total`. Falla si la cabecera es ilegible o si los campos más
+     *        el salto final no caben en los `disponibles` bytes siguientes.
+     */
+    static bool leerCabecera(string_view cabecera, size_t disponibles,
+                             size_t (&largos)[4], size_t& total) {
+        const char* p = cabecera.data() + 1;
+        const char* fin = cabecera.data() + cabecera.size();
+        for (size_t& largo : largos) {
+            while (p < fin && *p == ' ') p++;
+            auto res = from_chars(p, fin, largo);
+            if (res.ec != errc()) return false;
+            p = res.ptr;
+        }
+        if (!recortar(string_view(p, fin - p)).empty()) return false;
+
+        // Se acota cada suma para que longitudes enormes no den la vuelta
+        total = 0;
+        for (size_t largo : largos) {
+            if (largo >= disponibles - total) return false;
+            total += largo;
+        }
+        return true;
+    }
+
+    EstadoRegistro leerConLongitudes(CamposCorreo& campos) {
+        string_view cabecera = cortarCampo(resto, '\n');
+        size_t largos[4], total;
+        if (!leerCabecera(cabecera, resto.size(), largos, total)) {
+            resincronizar();
+            return REGISTRO_INVALIDO;
+        }
+        // Las longitudes caben: se descarta el registro completo
+        if (resto[total] != '\n') {
+            resto = resto.substr(total + 1);
+            return REGISTRO_INVALIDO;
+        }
+
+        string_view* destinos[4] = {&campos.rem, &campos.asu, &campos.cue, &campos.fec};
+        size_t pos = 0;
+        for (int i = 0; i < 4; i++) {
+            *destinos[i] = resto.substr(pos, largos[i]);
+            pos += largos[i];
+        }
+        resto = resto.substr(total + 1);
+        return REGISTRO_VALIDO;
+    }
+
+public:
+    explicit LectorRegistros(string_view datos) : resto(datos) {}
+
+    /**
+     * @brief Bytes que ocupa el registro al comienzo de `datos`, incluido su
+     *        salto de línea final, mirando solo su forma: una cabecera de
+     *        longitudes que caben y terminan en '\n', una línea clásica con
+     *        al menos tres ';' o una línea en blanco. Devuelve 0 si lo que
+     *        empieza ahí no tiene forma de registro. No lee los campos.
+     */
+    static size_t largoRegistro(string_view datos) {
+        size_t salto = datos.find('\n');
+        size_t linea = (salto == string_view::npos) ? datos.size() : salto + 1;
+        if (datos.empty() || datos[0] != '#') {
+            string_view texto = datos.substr(0, linea);
+            if (recortar(texto).empty() || count(texto.begin(), texto.end(), ';') >= 3)
+                return linea;
+            return 0;
+        }
+        if (salto == string_view::npos) return 0;
+        size_t largos[4], total;
+        if (!leerCabecera(datos.substr(0, salto), datos.size() - linea, largos, total) ||
+            datos[linea + total] != '\n')
+            return 0;
+        return linea + total + 1;
+    }
+
+    /**
+     * @brief Indica si ya se consumió todo el bloque.
+     */
+    bool fin() const { return resto.empty(); }
+
+    /**
+     * @brief Posición del siguiente registro dentro del bloque original.
+     */
+    const char* posicion() const { return resto.data(); }
+
+    /**
+     * @brief Lee el siguiente registro y avanza (requiere !fin()). Un
+     *        registro mal formado se consume completo, o hasta el fin de su
+     *        línea, para poder continuar. Si su cabecera de longitudes no se
+     *        puede usar, se salta hasta el próximo registro reconocible.
+     */
+    EstadoRegistro siguiente(CamposCorreo& campos) {
+        EstadoRegistro estado = (resto[0] == '#') ? leerConLongitudes(campos)
+                                                  : leerClasico(campos);
+        if (estado == REGISTRO_VALIDO &&
+            (campos.rem.empty() || !leerFecha(campos.fec, campos.fecha)))
+            return REGISTRO_INVALIDO;
+        return estado;
+    }
+
+    /**
+     * @brief Indica si lo siguiente es una marca de borrado (requiere !fin()).
+     */
+    bool esBorrado() const { return resto[0] == '-'; }
+
+    /**
+     * @brief Lee una marca de borrado y avanza hasta el fin de su línea
+     *        (requiere esBorrado()). Sin el salto de línea final la marca se
+     *        considera truncada: "-12" podría ser el comienzo de "-123".
+     */
+    EstadoRegistro leerBorrado(int& id, uint64_t& huella) {
+        if (resto.find('\n') == string_view::npos) {
+            resto = string_view();
+            return REGISTRO_INVALIDO;
+        }
+        string_view linea = recortar(cortarCampo(resto, '\n'));
+        const char* fin = linea.data() + linea.size();
+        auto res = from_chars(linea.data() + 1, fin, id);
+        if (res.ec != errc() || id <= 0) return REGISTRO_INVALIDO;
+        huella = 0;
+        if (res.ptr < fin && *res.ptr == ' ') res = from_chars(res.ptr + 1, fin, huella);
+        if (res.ec != errc() || res.ptr != fin) return REGISTRO_INVALIDO;
+        return REGISTRO_VALIDO;
+    }
+};
+
+/**
+ * @brief Agrega a `out` un correo en el formato con longitudes de
+ *        LectorRegistros.
+ */
+void serializarRegistro(string& out, const Correo& c) {
+    string fecha = textoFecha(c.fecha);
+    out += '#';
+    out += to_string(c.remitente.size()) + ' ' + to_string(c.asunto.size()) + ' '
+         + to_string(c.cuerpo.size()) + ' ' + to_string(fecha.size());
+    out += '\n';
+    out += c.remitente;
+    out += c.asunto;
+    out += c.cuerpo;
+    out += fecha;
+    out += '\n';
+}
+
+/**
+ * @brief Huella (FNV-1a de 64 bits) del contenido de un correo. Identifica
+ *        al correo en las marcas de borrado del diario aunque al
+ *        reconstruir los índices desde correos.txt reciba otro ID.
+ */
+uint64_t huellaCorreo(const Correo& c) {
+    uint64_t h = 14695981039346656037ull;
+    auto mezclar = [&](string_view campo) {
+        // La longitud primero, para que los límites entre campos cuenten
+        for (size_t i = 0, n = campo.size(); i < sizeof n; i++, n >>= 8)
+            h = (h ^ (n & 0xff)) * 1099511628211ull;
+        for (char ch : campo) h = (h ^ (unsigned char)ch) * 1099511628211ull;
+    };
+    mezclar(c.remitente);
+    mezclar(c.asunto);
+    mezclar(cuerpoDe(c));
+    mezclar(textoFecha(c.fecha));
+    return h;
+}
+
+/**
+ * @brief Agrega a `out` la marca de borrado de un correo.
+ */
+void serializarBorrado(string& out, int id, uint64_t huella) {
+    out += '-';
+    out += to_string(id) + ' ' + to_string(huella);
+    out += '\n';
+}
+
+/// Registros consecutivos que deben encadenarse desde un posible corte
+const int REGISTROS_CORTE = 4;
+
+/**
+ * @brief Primer límite de registro en `contenido` a partir de `desde`.
+ *
+ * Un comienzo de línea puede caer dentro del contenido de un registro con
+ * longitudes, que admite saltos de línea. Por eso se acepta solo si desde
+ * él se encadenan REGISTROS_CORTE registros bien formados (o se llega al
+ * final); si no, se prueba con la línea siguiente.
+ */
+size_t siguienteLimite(string_view contenido, size_t desde) {
+    size_t pos = desde;
+    while (pos < contenido.size()) {
+        if (pos == 0 || contenido[pos - 1] == '\n') {
+            string_view resto = contenido.substr(pos);
+            int encadenados = 0;
+            while (encadenados < REGISTROS_CORTE && !resto.empty()) {
+                size_t largo = LectorRegistros::largoRegistro(resto);
+                if (largo == 0) break;
+                resto.remove_prefix(largo);
+                encadenados++;
+            }
+            if (encadenados == REGISTROS_CORTE || resto.empty()) return pos;
+        }
+        pos = contenido.find('\n', pos);
+        if (pos == string_view::npos) return contenido.size();
+        pos++;
+    }
+    return contenido.size();
+}
+
+/**
+ * @brief Divide el contenido en a lo sumo `n` bloques de tamaño similar
+ *        que comienzan y terminan en límites de registro. Cada corte salta
+ *        directamente a su posición, k·tamaño/n, y avanza solo hasta el
+ *        límite de registro siguiente, sin recorrer los registros previos.
+ */
+vector<string_view> dividirEnBloques(string_view contenido, unsigned n) {
+    vector<string_view> bloques;
+    size_t inicio = 0;
+    for (unsigned k = 1; k < n && inicio < contenido.size(); k++) {
+        size_t corte = siguienteLimite(contenido,
+                                       max(inicio, contenido.size() / n * k));
+        if (corte > inicio && corte < contenido.size()) {
+            bloques.push_back(contenido.substr(inicio, corte - inicio));
+            inicio = corte;
+        }
+    }
+    if (inicio < contenido.size()) bloques.push_back(contenido.substr(inicio));
+    return bloques;
+}
+
+/**
+ * @struct IndiceParcial
+ * @brief Resultado de procesar un bloque del archivo en un hilo: correos
+ *        aún sin ID y sus índices locales, donde cada correo se identifica
+ *        por su posición dentro del bloque. Los remitentes ya van
+ *        normalizados y se internan al fusionar.
+ */
+struct IndiceParcial {
+    /**
+     * @struct InvertidoLocal
+     * @brief Índice invertido sin comprimir de un campo del bloque, con IDs
+     *        de término locales en orden de aparición; se comprime al
+     *        fusionar en las listas del segmento.
+     */
+    struct InvertidoLocal {
+        struct PostingsLocales {
+            vector<int> ids;
+            vector<int> frecuencias;
+        };
+
+        TablaTerminos terminos;
+        vector<PostingsLocales> invertido;     ///< ID local de término -> postings
+
+        int internar(const string& termino) {
+            int id = terminos.internar(termino);
+            if ((size_t)id == invertido.size()) invertido.emplace_back();
+            return id;
+        }
+
+        /// Agrega la fila que dejó el tokenizador para el correo `local`.
+        void agregar(const vector<pair<int, int>>& fila, int local) {
+            for (auto [termino, frecuencia] : fila) {
+                invertido[termino].ids.push_back(local);
+                invertido[termino].frecuencias.push_back(frecuencia);
+            }
+        }
+
+        /// Agrega las listas al índice del segmento, desplazando los IDs.
+        void fusionarEn(IndiceCampo& indice, int base) const {
+            for (size_t t = 0; t < invertido.size(); t++) {
+                ListaPostings& lista = indice.postings[indice.internar(terminos.texto((int)t))];
+                for (size_t i = 0; i < invertido[t].ids.size(); i++)
+                    lista.agregar(base + invertido[t].ids[i], invertido[t].frecuencias[i]);
+            }
+        }
+    };
+
+    vector<Correo> correos;
+    vector<string_view> cuerpos;           ///< Con almacén de cuerpos: cada cuerpo, en el archivo
+    vector<int> longitudes;
+    vector<string> remitentes;             ///< Remitente normalizado de cada correo
+    InvertidoLocal texto;
+    InvertidoLocal asunto;
+    int malFormados = 0;
+};
+
+/**
+ * @brief Separa, tokeniza e indexa localmente las líneas de un bloque.
+ *        Solo escribe en `parcial`, por lo que es seguro entre hilos.
+ */
+void procesarBloque(string_view bloque, IndiceParcial& parcial) {
+    LectorRegistros lector(bloque);
+    CamposCorreo campos;
+    Tokenizador tok;
+    auto internarTexto = [&](const string& t) { return parcial.texto.internar(t); };
+    auto internarAsunto = [&](const string& t) { return parcial.asunto.internar(t); };
+    while (!lector.fin()) {
+        EstadoRegistro estado = lector.siguiente(campos);
+        if (estado == REGISTRO_INVALIDO) parcial.malFormados++;
+        if (estado != REGISTRO_VALIDO) continue;
+
+        // Con el almacén de cuerpos activo el cuerpo no se copia: se escribe
+        // desde el archivo al fusionar
+        int local = (int)parcial.correos.size();
+        bool copiarCuerpo = !almacenCuerpos.activo();
+        parcial.correos.push_back({0, string(campos.rem), string(campos.asu),
+                                   copiarCuerpo ? string(campos.cue) : string(), campos.fecha});
+        if (!copiarCuerpo) parcial.cuerpos.push_back(campos.cue);
+
+        const Correo& c = parcial.correos.back();
+        parcial.remitentes.push_back(normalizarRemitente(c.remitente));
+        parcial.longitudes.push_back(tok.contar(c.asunto, campos.cue, internarTexto));
+        parcial.texto.agregar(tok.fila(), local);
+        tok.contarCampo(c.asunto, internarAsunto);
+        parcial.asunto.agregar(tok.fila(), local);
+    }
+}
+
+/**
+ * @brief Incorpora un índice parcial al segmento abierto. Los correos del
+ *        bloque reciben IDs consecutivos y sus postings locales se
+ *        desplazan y se agregan al final, de modo que las listas siguen
+ *        ordenadas si los bloques se fusionan en el orden del archivo. Los
+ *        términos se internan en su orden local de aparición, así que sus
+ *        IDs también coinciden con los de una carga secuencial. Los cuerpos
+ *        del bloque se escriben antes en el almacén de cuerpos, si está
+ *        activo; si la escritura falla se copian a memoria. Requiere
+ *        mutexEscritor y que el archivo de los cuerpos siga abierto.
+ */
+int fusionarParcial(IndiceParcial& parcial) {
+    Segmento& seg = segmentoParaEscribir();
+    int base = (int)almacenCorreos.tamano() + 1;
+
+    if (!parcial.cuerpos.empty()) {
+        for (size_t i = 0; i < parcial.correos.size(); i++) {
+            if (parcial.cuerpos[i].empty()) continue;
+            parcial.correos[i].posicionCuerpo = almacenCuerpos.agregar(parcial.cuerpos[i]);
+            parcial.correos[i].largoCuerpo = (uint32_t)parcial.cuerpos[i].size();
+        }
+        if (!almacenCuerpos.escribirPendiente()) {
+            for (size_t i = 0; i < parcial.correos.size(); i++) {
+                parcial.correos[i].cuerpo = string(parcial.cuerpos[i]);
+                parcial.correos[i].largoCuerpo = 0;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < parcial.correos.size(); i++) {
+        const Correo& c = almacenCorreos.agregar(move(parcial.correos[i]));
+        seg.longitudes.push_back(parcial.longitudes[i]);
+        seg.totalTerminos += parcial.longitudes[i];
+        seg.indexarRemitente(c.id, parcial.remitentes[i]);
+        seg.calendario.insertar(c);
+    }
+    seg.nCorreos += (int)parcial.correos.size();
+
+    parcial.texto.fusionarEn(seg.texto, base);
+    parcial.asunto.fusionarEn(seg.asunto, base);
+
+    int malFormados = parcial.malFormados;
+    parcial = IndiceParcial();
+    return malFormados;
+}
+
+/// Tamaño mínimo de bloque que justifica lanzar un hilo adicional.
+const size_t MIN_BYTES_POR_HILO = 1 << 20;
+
+/**
+ * @brief Carga correos desde un archivo con los formatos que acepta
+ *        LectorRegistros. Los registros mal formados se omiten.
+ *
+ *        El archivo se proyecta en memoria y los campos se separan en su
+ *        lugar como string_view; cada campo se copia una única vez.
+ *
+ *        La carga es paralela: el archivo se divide en bloques alineados a
+ *        límites de registro, cada hilo tokeniza su bloque y construye índices
+ *        parciales, y después los bloques se fusionan en orden. Los IDs
+ *        resultantes son los mismos que con una carga secuencial. Los
+ *        correos cargados se publican juntos al terminar.
+ *
+ * @param hilos Número de hilos a usar (0 = según los núcleos disponibles).
+ * @return Registros mal formados que se omitieron, o -1 si no se pudo
+ *         abrir el archivo.
+ */
+int cargarCorreosDesdeArchivo(string nombreArchivo, unsigned hilos = 0) {
+    MedirLatencia medir(OP_CARGA);
+    ArchivoMapeado archivo(nombreArchivo);
+    if (!archivo.abierto()) return -1;
+
+    string_view contenido = archivo.contenido();
+
+    if (hilos == 0) hilos = max(1u, thread::hardware_concurrency());
+    hilos = (unsigned)min<size_t>(hilos, contenido.size() / MIN_BYTES_POR_HILO + 1);
+
+    vector<string_view> bloques = dividirEnBloques(contenido, hilos);
+
+    vector<IndiceParcial> parciales(bloques.size());
+    vector<thread> trabajadores;
+    for (size_t i = 1; i < bloques.size(); i++)
+        trabajadores.emplace_back(procesarBloque, bloques[i], ref(parciales[i]));
+    if (!bloques.empty())
+        procesarBloque(bloques[0], parciales[0]);
+    for (thread& t : trabajadores) t.join();
+
+    // Los bloques se fusionan en un solo segmento, que se publica al final
+    int malFormados = 0;
+    {
+        lock_guard<mutex> bloqueo(mutexEscritor);
+        for (IndiceParcial& parcial : parciales)
+            malFormados += fusionarParcial(parcial);
+        publicarSegmentoAbierto();
+    }
+    return malFormados;
+}
+
+// ============================================================================
+// INSTANTÁNEA BINARIA DE LOS ÍNDICES
+// ============================================================================
+/*
+ * La instantánea es un manifiesto más un archivo por segmento. Como los
+ * segmentos sellados no cambian, cada archivo de segmento se escribe una
+ * sola vez: guardar una instantánea solo escribe los segmentos nuevos (los
+ * publicados o fusionados desde la anterior) y el manifiesto, y después
+ * borra los archivos de segmentos que ya no están en la vista. Los borrados
+ * van en el manifiesto; un segmento fusionado guarda sin texto los correos
+ * que descartó, así que el espacio se recupera al reemplazar los archivos.
+ *
+ * Formato (enteros en el orden de bytes de la máquina, todos de 32 bits
+ * salvo donde se indica). El manifiesto:
+ *
+ *   Cabecera       magia[8] "CORRIDX\0", version, marcaOrden (0x01020304),
+ *                  nCorreos, nSegmentos, firmaAnalisis, cuerposEnDisco,
+ *                  bytesDiario (64 bits: parte del diario ya incluida)
+ *   Segmentos      nSegmentos números de segmento (64 bits), en orden de IDs
+ *   Borrados       nSegmentos cantidades de borrados, y luego los IDs
+ *                  borrados de cada segmento, concatenados en orden
+ *
+ * y el archivo "<manifiesto>.<número>.seg" de cada segmento:
+ *
+ *   Cabecera       magia[8] "CORRSEG\0", version, marcaOrden, firmaAnalisis,
+ *                  primerId, numero (64 bits), nCorreos, nTerminos[3] (de
+ *                  los índices texto, asunto y remitente), nRemitentes,
+ *                  nVigentes, cuerposEnDisco, reservado
+ *   Correos        nCorreos x {lenRem, lenAsu, lenCue, fecha empaquetada}
+ *                  (0 en los descartados)
+ *   Cuerpos        solo si cuerposEnDisco: nCorreos x {largo, posición (64
+ *                  bits)} en el almacén de cuerpos (largo 0 = el cuerpo va
+ *                  en el texto)
+ *   Orden          nVigentes IDs en orden de fecha (recorrido del
+ *                  calendario); los del tramo que no figuran son los
+ *                  descartados
+ *   Longitudes     nCorreos longitudes en términos, en orden de ID
+ *   Términos       por cada índice, nTerminos x {lenTermino, nPostings, nBytes},
+ *                  en orden de ID
+ *   Remitentes     nRemitentes x {lenRemitente, nIDs}, en orden de ID
+ *   IDs remitente  todas las listas de IDs por remitente, concatenadas
+ *   Postings       las listas de postings comprimidas (nBytes cada una,
+ *                  ver ListaPostings::serializar), índice por índice
+ *   Texto          remitente, asunto y cuerpo de cada correo, términos de
+ *                  cada índice y remitentes, en ese orden y sin separadores
+ *
+ * Los correos se guardan en orden de ID, así que el ID es implícito. Al
+ * cargar, cada archivo se proyecta en memoria: las listas de IDs se copian
+ * en bloque, las de postings se recorren una vez para rearmar los saltos
+ * y los textos se toman por longitud, sin tokenizar ni separar campos de
+ * nuevo. Cada calendario se arma en O(n) desde el orden guardado.
+ */
+
+const char MAGIA_INSTANTANEA[8] = {'C', 'O', 'R', 'R', 'I', 'D', 'X', '\0'};
+const char MAGIA_SEGMENTO[8] = {'C', 'O', 'R', 'R', 'S', 'E', 'G', '\0'};
+const uint32_t VERSION_INSTANTANEA = 13;
+const uint32_t MARCA_ORDEN_BYTES = 0x01020304;
+
+/**
+ * @struct CabeceraInstantanea
+ * @brief Cabecera fija de 40 bytes al inicio del manifiesto.
+ */
+struct CabeceraInstantanea {
+    char magia[8];
+    uint32_t version;
+    uint32_t marcaOrden;
+    uint32_t nCorreos;
+    uint32_t nSegmentos;
+    uint32_t firmaAnalisis;   ///< Analizador con el que se armó el índice
+    uint32_t cuerposEnDisco;  ///< 1 si los cuerpos están en el almacén de cuerpos
+    uint64_t bytesDiario;
+};
+
+/**
+ * @struct CabeceraSegmento
+ * @brief Cabecera fija de 64 bytes al inicio de cada archivo de segmento.
+ */
+struct CabeceraSegmento {
+    char magia[8];
+    uint32_t version;
+    uint32_t marcaOrden;
+    uint32_t firmaAnalisis;
+    uint32_t primerId;
+    uint64_t numero;
+    uint32_t nCorreos;
+    uint32_t nTerminos[3];   ///< De los índices texto, asunto y remitente
+    uint32_t nRemitentes;
+    uint32_t nVigentes;   ///< Correos del tramo que no se descartaron
+    uint32_t cuerposEnDisco;
+    uint32_t reservado;
+};
+
+/**
+ * @brief Serializa los guardados de instantáneas (el hilo de mantenimiento
+ *        y el principal pueden guardar).
+ */
+mutex mutexInstantanea;
+
+/// Segmentos que ya tienen su archivo escrito (protegido por mutexInstantanea).
+unordered_set<uint64_t> segmentosGuardados;
+
+/// Generación de la vista guardada en la última instantánea.
+atomic<uint64_t> generacionGuardada{0};
+
+uint64_t posicionDiario(uint64_t& secuencia);
+bool esperarDiario(uint64_t secuencia);
+
+/**
+ * @brief Indica si la instantánea existe y es más reciente que el archivo
+ *        de correos del que se construyó.
+ */
+bool instantaneaVigente(const string& instantanea, const string& fuente) {
+    error_code ec;
+    auto tInst = filesystem::last_write_time(instantanea, ec);
+    if (ec) return false;
+    auto tFuente = filesystem::last_write_time(fuente, ec);
+    return ec || tInst >= tFuente;
+}
+
+/**
+ * @brief Nombre del archivo de un segmento de la instantánea.
+ */
+string archivoSegmento(const string& instantanea, uint64_t numero) {
+    return instantanea + "." + to_string(numero) + ".seg";
+}
+
+/**
+ * @brief Escribe el archivo de un segmento (en un temporal que luego
+ *        renombra).
+ * @return true si el archivo quedó guardado.
+ */
+bool escribirSegmento(const string& nombreArchivo, const Segmento& s) {
+    string temporal = nombreArchivo + ".tmp";
+    ofstream out(temporal, ios::binary | ios::trunc);
+    if (!out.is_open()) return false;
+
+    auto escribir32 = [&](uint32_t v) { out.write((const char*)&v, sizeof v); };
+
+    CabeceraSegmento cab;
+    memcpy(cab.magia, MAGIA_SEGMENTO, sizeof cab.magia);
+    cab.version = VERSION_INSTANTANEA;
+    cab.marcaOrden = MARCA_ORDEN_BYTES;
+    cab.firmaAnalisis = analizadorTerminos.firma();
+    cab.primerId = (uint32_t)s.primerId;
+    cab.numero = s.numero;
+    cab.nCorreos = (uint32_t)s.nCorreos;
+    const IndiceCampo* indices[3] = {&s.texto, &s.asunto, &s.remitente};
+    for (int k = 0; k < 3; k++) cab.nTerminos[k] = (uint32_t)indices[k]->tamano();
+    cab.nRemitentes = (uint32_t)s.remitentes.tamano();
+    cab.nVigentes = (uint32_t)s.vigentes();
+    cab.cuerposEnDisco = almacenCuerpos.activo();
+    cab.reservado = 0;
+    out.write((const char*)&cab, sizeof cab);
+
+    // Los descartados se guardan como correos vacíos
+    const Correo vacio{};
+    auto correo = [&](int id) -> const Correo& {
+        return estaBorrado(s.descartados.get(), id) ? vacio : *almacenCorreos.buscar(id);
+    };
+    for (int id = s.primerId; id <= s.ultimoId(); id++) {
+        const Correo& c = correo(id);
+        escribir32((uint32_t)c.remitente.size());
+        escribir32((uint32_t)c.asunto.size());
+        escribir32((uint32_t)c.cuerpo.size());
+        escribir32(c.fecha);
+    }
+    if (cab.cuerposEnDisco) {
+        for (int id = s.primerId; id <= s.ultimoId(); id++) {
+            const Correo& c = correo(id);
+            escribir32(c.largoCuerpo);
+            out.write((const char*)&c.posicionCuerpo, sizeof c.posicionCuerpo);
+        }
+    }
+
+    CalendarioCorreos::Cursor cur = s.calendario.rango();
+    for (; cur.valido(); cur.avanzar())
+        escribir32((uint32_t)cur.actual()->id);
+    for (int longitud : s.longitudes) escribir32((uint32_t)longitud);
+
+    vector<uint8_t> postings;
+    for (const IndiceCampo* indice : indices) {
+        for (size_t t = 0; t < indice->tamano(); t++) {
+            const ListaPostings& lista = indice->postings[t];
+            size_t antes = postings.size();
+            lista.serializar(postings);
+            escribir32((uint32_t)indice->terminos.texto((int)t).size());
+            escribir32((uint32_t)lista.tamano());
+            escribir32((uint32_t)(postings.size() - antes));
+        }
+    }
+    for (size_t i = 0; i < s.remitentes.tamano(); i++) {
+        escribir32((uint32_t)s.remitentes.texto((int)i).size());
+        escribir32((uint32_t)s.correosPorRemitente[i].size());
+    }
+
+    for (auto& lista : s.correosPorRemitente)
+        out.write((const char*)lista.data(), lista.size() * sizeof(int));
+    out.write((const char*)postings.data(), postings.size());
+
+    for (int id = s.primerId; id <= s.ultimoId(); id++) {
+        const Correo& c = correo(id);
+        out << c.remitente << c.asunto << c.cuerpo;
+    }
+    for (const IndiceCampo* indice : indices)
+        for (size_t t = 0; t < indice->tamano(); t++) out << indice->terminos.texto((int)t);
+    for (size_t i = 0; i < s.remitentes.tamano(); i++) out << s.remitentes.texto((int)i);
+
+    out.close();
+    if (!out) return false;
+
+    error_code ec;
+    filesystem::rename(temporal, nombreArchivo, ec);
+    return !ec;
+}
+
+/**
+ * @brief Borra los archivos de segmento de la instantánea que no están en
+ *        la vista (los que se fusionaron o quedaron de una ejecución
+ *        anterior). Requiere mutexInstantanea.
+ */
+void borrarSegmentosObsoletos(const string& instantanea, const VistaIndice& vista) {
+    unordered_set<uint64_t> vigentes;
+    for (const auto& s : vista.segmentos) vigentes.insert(s->numero);
+
+    filesystem::path ruta(instantanea);
+    string prefijo = ruta.filename().string() + ".";
+    filesystem::path carpeta = ruta.parent_path().empty() ? filesystem::path(".") : ruta.parent_path();
+    error_code ec;
+    for (const auto& entrada : filesystem::directory_iterator(carpeta, ec)) {
+        string nombre = entrada.path().filename().string();
+        if (nombre.size() <= prefijo.size() + 4 || nombre.compare(0, prefijo.size(), prefijo) != 0 ||
+            nombre.compare(nombre.size() - 4, 4, ".seg") != 0)
+            continue;
+        uint64_t numero;
+        const char* ini = nombre.data() + prefijo.size();
+        const char* fin = nombre.data() + nombre.size() - 4;
+        auto [ptr, err] = from_chars(ini, fin, numero);
+        if (err != errc() || ptr != fin || vigentes.count(numero)) continue;
+        error_code ecBorrar;
+        filesystem::remove(entrada.path(), ecBorrar);
+        segmentosGuardados.erase(numero);
+    }
+}
+
+/**
+ * @brief Guarda la vista vigente (antes se publica el segmento abierto):
+ *        escribe los segmentos que aún no tienen archivo y luego el
+ *        manifiesto, en un temporal que se renombra, de modo que una
+ *        instantánea a medio escribir nunca reemplaza a la anterior. Los
+ *        escritores pueden seguir agregando correos mientras tanto; quedan
+ *        para la siguiente instantánea.
+ * @return true si la instantánea quedó guardada.
+ */
+bool guardarInstantanea(const string& nombreArchivo) {
+    lock_guard<mutex> guardando(mutexInstantanea);
+
+    // La vista y la parte del diario que cubre se toman juntas
+    shared_ptr<const VistaIndice> vista;
+    uint64_t bytesDiario, secDiario;
+    {
+        lock_guard<mutex> bloqueo(mutexEscritor);
+        publicarSegmentoAbierto();
+        bytesDiario = posicionDiario(secDiario);
+        vista = vistaActual();
+    }
+    // Lo que cubre la instantánea debe estar en el diario antes de guardarla;
+    // se espera fuera de mutexEscritor para no frenar a los escritores
+    if (!esperarDiario(secDiario)) return false;
+
+    // Los segmentos nuevos pueden referenciar cuerpos recién escritos
+    if (!almacenCuerpos.sincronizar()) return false;
+    for (const auto& s : vista->segmentos) {
+        if (segmentosGuardados.count(s->numero)) continue;
+        if (!escribirSegmento(archivoSegmento(nombreArchivo, s->numero), *s)) return false;
+        segmentosGuardados.insert(s->numero);
+    }
+
+    string temporal = nombreArchivo + ".tmp";
+    ofstream out(temporal, ios::binary | ios::trunc);
+    if (!out.is_open()) return false;
+
+    CabeceraInstantanea cab;
+    memcpy(cab.magia, MAGIA_INSTANTANEA, sizeof cab.magia);
+    cab.version = VERSION_INSTANTANEA;
+    cab.marcaOrden = MARCA_ORDEN_BYTES;
+    cab.nCorreos = (uint32_t)vista->nCorreos;
+    cab.nSegmentos = (uint32_t)vista->segmentos.size();
+    cab.firmaAnalisis = analizadorTerminos.firma();
+    cab.cuerposEnDisco = almacenCuerpos.activo();
+    cab.bytesDiario = bytesDiario;
+    out.write((const char*)&cab, sizeof cab);
+    for (const auto& s : vista->segmentos)
+        out.write((const char*)&s->numero, sizeof s->numero);
+    for (const auto& b : vista->borrados) {
+        uint32_t n = b ? (uint32_t)b->tamano() : 0;
+        out.write((const char*)&n, sizeof n);
+    }
+    for (const auto& b : vista->borrados)
+        if (b) b->recorrer([&](int id) { out.write((const char*)&id, sizeof id); });
+
+    out.close();
+    if (!out) return false;
+
+    error_code ec;
+    filesystem::rename(temporal, nombreArchivo, ec);
+    if (ec) return false;
+
+    borrarSegmentosObsoletos(nombreArchivo, *vista);
+    generacionGuardada = vista->generacion;
+    return true;
+}
+
+/**
+ * @struct SegmentoLeido
+ * @brief Segmento recuperado de una instantánea, con sus correos aún fuera
+ *        del almacén y su orden por fecha todavía como IDs: el calendario se
+ *        arma cuando los correos ya están en el almacén.
+ */
+struct SegmentoLeido {
+    unique_ptr<Segmento> seg;
+    vector<Correo> correos;
+    vector<uint32_t> orden;
+};
+
+/**
+ * @brief Lee y valida el archivo de un segmento. Solo escribe en `out`.
+ * @return false si el archivo no existe o no es el segmento `numero`
+ *         válido que empieza en `primerId` sin pasar de `maxId`.
+ */
+bool leerSegmento(const string& nombreArchivo, uint64_t numero, int primerId, int maxId,
+                  SegmentoLeido& out) {
+    ArchivoMapeado archivo(nombreArchivo);
+    if (!archivo.abierto()) return false;
+    string_view datos = archivo.contenido();
+    const char* p = datos.data();
+    const char* fin = datos.data() + datos.size();
+
+    CabeceraSegmento cab;
+    if (datos.size() < sizeof cab) return false;
+    memcpy(&cab, p, sizeof cab);
+    p += sizeof cab;
+    if (memcmp(cab.magia, MAGIA_SEGMENTO, sizeof cab.magia) != 0 ||
+        cab.version != VERSION_INSTANTANEA || cab.marcaOrden != MARCA_ORDEN_BYTES ||
+        cab.firmaAnalisis != analizadorTerminos.firma() || cab.numero != numero ||
+        cab.primerId != (uint32_t)primerId || cab.nCorreos == 0 ||
+        cab.nCorreos > (uint32_t)(maxId - primerId + 1) || cab.nVigentes > cab.nCorreos ||
+        cab.cuerposEnDisco != (uint32_t)almacenCuerpos.activo())
+        return false;
+    size_t nCorreos = cab.nCorreos, nRemitentes = cab.nRemitentes;
+    size_t nVigentes = cab.nVigentes;
+    size_t nTerminos = (size_t)cab.nTerminos[0] + cab.nTerminos[1] + cab.nTerminos[2];
+    int ultimoId = primerId + (int)nCorreos - 1;
+
+    // Tablas de tamaño fijo a continuación de la cabecera
+    size_t nCuerpos = cab.cuerposEnDisco ? nCorreos : 0;
+    size_t nTablas = 5 * nCorreos + 3 * nCuerpos + nVigentes + 3 * nTerminos + 2 * nRemitentes;
+    if ((size_t)(fin - p) / 4 < nTablas) return false;
+    vector<uint32_t> tablas(nTablas);
+    memcpy(tablas.data(), p, nTablas * 4);
+    p += nTablas * 4;
+
+    const uint32_t* largosCorreo = tablas.data();
+    const uint32_t* cuerpos = largosCorreo + 4 * nCorreos;
+    const uint32_t* orden = cuerpos + 3 * nCuerpos;
+    const uint32_t* longitudes = orden + nVigentes;
+    const uint32_t* tablaTerm = longitudes + nCorreos;
+    const uint32_t* tablaRem = tablaTerm + 3 * nTerminos;
+
+    // Verifica que el tamaño total coincida antes de armar nada
+    size_t nIDs = 0, nBytesPostings = 0, nTexto = 0;
+    for (size_t i = 0; i < nCorreos; i++)
+        nTexto += (size_t)largosCorreo[4 * i] + largosCorreo[4 * i + 1] + largosCorreo[4 * i + 2];
+    for (size_t i = 0; i < nTerminos; i++) {
+        nTexto += tablaTerm[3 * i];
+        nBytesPostings += tablaTerm[3 * i + 2];
+    }
+    for (size_t i = 0; i < nRemitentes; i++) {
+        nTexto += tablaRem[2 * i];
+        nIDs += tablaRem[2 * i + 1];
+    }
+    if ((size_t)(fin - p) != nIDs * 4 + nBytesPostings + nTexto) return false;
+
+    // Los IDs del orden deben ser distintos; los que faltan son los descartados
+    MapaBorrados enOrden(primerId, (int)nCorreos);
+    for (size_t i = 0; i < nVigentes; i++)
+        if (orden[i] < (uint32_t)primerId || orden[i] > (uint32_t)ultimoId ||
+            !enOrden.agregar((int)orden[i]))
+            return false;
+
+    const char* ids = p;
+    const uint8_t* postings = (const uint8_t*)p + nIDs * 4;
+    const char* texto = (const char*)postings + nBytesPostings;
+    auto tomarTexto = [&](uint32_t largo) {
+        string t(texto, largo);
+        texto += largo;
+        return t;
+    };
+
+    out.correos.resize(nCorreos);
+    for (size_t i = 0; i < nCorreos; i++) {
+        const uint32_t* l = largosCorreo + 4 * i;
+        Correo& c = out.correos[i];
+        c.remitente = tomarTexto(l[0]);
+        c.asunto = tomarTexto(l[1]);
+        c.cuerpo = tomarTexto(l[2]);
+        c.fecha = l[3];
+        // Los descartados se guardan con fecha 0
+        bool vigente = enOrden.contiene(primerId + (int)i);
+        if (vigente ? !fechaEnRango(c.fecha) : c.fecha != 0) return false;
+        if (nCuerpos > 0) {
+            c.largoCuerpo = cuerpos[3 * i];
+            memcpy(&c.posicionCuerpo, cuerpos + 3 * i + 1, sizeof c.posicionCuerpo);
+            if (c.largoCuerpo > 0 && (!c.cuerpo.empty() ||
+                                      c.posicionCuerpo + c.largoCuerpo > almacenCuerpos.tamano()))
+                return false;
+        }
+    }
+
+    out.seg = make_unique<Segmento>();
+    Segmento& s = *out.seg;
+    s.numero = numero;
+    s.primerId = primerId;
+    s.nCorreos = (int)nCorreos;
+    if (nVigentes < nCorreos) {
+        auto descartados = make_shared<MapaBorrados>(primerId, (int)nCorreos);
+        for (int id = primerId; id <= ultimoId; id++)
+            if (!enOrden.contiene(id)) descartados->agregar(id);
+        s.descartados = move(descartados);
+    }
+
+    // Los términos se guardan en orden de ID, así que al internarlos en
+    // ese orden recuperan su ID; las listas comprimidas se validan al
+    // rearmarlas
+    IndiceCampo* indices[3] = {&s.texto, &s.asunto, &s.remitente};
+    const uint32_t* fila = tablaTerm;
+    for (int k = 0; k < 3; k++) {
+        IndiceCampo& indice = *indices[k];
+        indice.terminos.reservar(cab.nTerminos[k]);
+        for (size_t i = 0; i < cab.nTerminos[k]; i++, fila += 3) {
+            if (indice.internar(tomarTexto(fila[0])) != (int)i) return false;
+            ListaPostings& lista = indice.postings[i];
+            if (!lista.cargar(postings, fila[2], fila[1]) || lista.ultimoId() > ultimoId ||
+                (!lista.vacia() && ListaPostings::Cursor(lista).doc() < primerId))
+                return false;
+            postings += fila[2];
+        }
+    }
+
+    s.remitentes.reservar(nRemitentes);
+    for (size_t i = 0; i < nRemitentes; i++) {
+        vector<int>& lista = s.listaRemitente(tomarTexto(tablaRem[2 * i]));
+        if (s.remitentes.tamano() != i + 1) return false;
+        lista.resize(tablaRem[2 * i + 1]);
+        memcpy(lista.data(), ids, lista.size() * 4);
+        ids += lista.size() * 4;
+        for (int id : lista)
+            if (id < primerId || id > ultimoId) return false;
+    }
+
+    s.longitudes.assign(longitudes, longitudes + nCorreos);
+    for (int longitud : s.longitudes) s.totalTerminos += longitud;
+    out.orden.assign(orden, orden + nVigentes);
+    return true;
+}
+
+/**
+ * @brief Recupera los índices desde una instantánea y los publica. Solo
+ *        debe llamarse con el almacén vacío.
+ * @param bytesDiario Recibe cuántos bytes del diario ya estaban incluidos.
+ * @return false si el manifiesto o algún segmento no existe o no es
+ *         válido; en ese caso las estructuras quedan vacías.
+ */
+bool cargarInstantanea(const string& nombreArchivo, uint64_t& bytesDiario) {
+    static_assert(sizeof(int) == sizeof(uint32_t), "los IDs se guardan en 32 bits");
+
+    vector<uint64_t> numeros;
+    vector<uint32_t> nBorrados;
+    vector<int> idsBorrados;
+    CabeceraInstantanea cab;
+    {
+        ArchivoMapeado archivo(nombreArchivo);
+        if (!archivo.abierto()) return false;
+        string_view datos = archivo.contenido();
+        if (datos.size() < sizeof cab) return false;
+        memcpy(&cab, datos.data(), sizeof cab);
+        size_t fijos = sizeof cab + (size_t)cab.nSegmentos * (sizeof(uint64_t) + sizeof(uint32_t));
+        if (memcmp(cab.magia, MAGIA_INSTANTANEA, sizeof cab.magia) != 0 ||
+            cab.version != VERSION_INSTANTANEA || cab.marcaOrden != MARCA_ORDEN_BYTES ||
+            cab.firmaAnalisis != analizadorTerminos.firma() || cab.nCorreos > INT_MAX ||
+            cab.cuerposEnDisco != (uint32_t)almacenCuerpos.activo() || datos.size() < fijos)
+            return false;
+        const char* p = datos.data() + sizeof cab;
+        numeros.resize(cab.nSegmentos);
+        memcpy(numeros.data(), p, numeros.size() * sizeof(uint64_t));
+        p += numeros.size() * sizeof(uint64_t);
+        nBorrados.resize(cab.nSegmentos);
+        memcpy(nBorrados.data(), p, nBorrados.size() * sizeof(uint32_t));
+        size_t total = 0;
+        for (uint32_t n : nBorrados) total += n;
+        if (datos.size() != fijos + total * sizeof(int)) return false;
+        idsBorrados.resize(total);
+        memcpy(idsBorrados.data(), datos.data() + fijos, total * sizeof(int));
+    }
+
+    // Verifica todos los segmentos antes de tocar las estructuras globales
+    vector<SegmentoLeido> segmentos(numeros.size());
+    int siguienteId = 1;
+    for (size_t i = 0; i < numeros.size(); i++) {
+        if (!leerSegmento(archivoSegmento(nombreArchivo, numeros[i]), numeros[i], siguienteId,
+                          (int)cab.nCorreos, segmentos[i]))
+            return false;
+        siguienteId += segmentos[i].seg->nCorreos;
+    }
+    if (siguienteId != (int)cab.nCorreos + 1) return false;
+
+    // Los borrados de cada segmento deben estar en su tramo e incluir a los
+    // que el segmento ya descartó
+    vector<shared_ptr<const MapaBorrados>> borrados(numeros.size());
+    const int* sigBorrado = idsBorrados.data();
+    for (size_t i = 0; i < numeros.size(); i++) {
+        const Segmento& s = *segmentos[i].seg;
+        auto mapa = make_shared<MapaBorrados>(s.primerId, s.nCorreos);
+        for (uint32_t j = 0; j < nBorrados[i]; j++, sigBorrado++)
+            if (*sigBorrado < s.primerId || *sigBorrado > s.ultimoId() || !mapa->agregar(*sigBorrado))
+                return false;
+        bool cubre = true;
+        if (s.descartados) s.descartados->recorrer([&](int id) { cubre = cubre && mapa->contiene(id); });
+        if (!cubre) return false;
+        if (mapa->tamano() > 0) borrados[i] = move(mapa);
+    }
+
+    shared_ptr<const VistaIndice> publicada;
+    {
+        lock_guard<mutex> bloqueo(mutexEscritor);
+        auto vista = make_shared<VistaIndice>();
+        vista->generacion = vistaActual()->generacion + 1;
+        for (size_t i = 0; i < segmentos.size(); i++) {
+            SegmentoLeido& sl = segmentos[i];
+            for (Correo& c : sl.correos) almacenCorreos.agregar(move(c));
+            vector<const Correo*> ordenados(sl.orden.size());
+            for (size_t i = 0; i < sl.orden.size(); i++)
+                ordenados[i] = almacenCorreos.buscar((int)sl.orden[i]);
+            sl.seg->calendario.construirDesdeOrdenados(ordenados);
+            siguienteNumeroSegmento = max(siguienteNumeroSegmento, sl.seg->numero + 1);
+            vista->nCorreos += sl.seg->nCorreos;
+            vista->totalTerminos += sl.seg->totalTerminos;
+            vista->segmentos.push_back(move(sl.seg));
+            vista->borrados.push_back(move(borrados[i]));
+        }
+        publicada = vista;
+        atomic_store(&vistaPublicada, publicada);
+    }
+
+    lock_guard<mutex> guardando(mutexInstantanea);
+    for (const auto& s : publicada->segmentos) segmentosGuardados.insert(s->numero);
+    borrarSegmentosObsoletos(nombreArchivo, *publicada);
+    generacionGuardada = publicada->generacion;
+
+    bytesDiario = cab.bytesDiario;
+    return true;
+}
+
+// ============================================================================
+// DIARIO DE CORREOS NUEVOS (WRITE-AHEAD LOG)
+// ============================================================================
+/*
+ * Los correos creados en tiempo de ejecución no están en correos.txt, así
+ * que se anotan, en el formato con longitudes, al final de un diario de
+ * solo escritura, junto con las marcas de los correos borrados. Nunca se
+ * reescribe: la instantánea guarda cuántos bytes del diario ya incluye y
+ * al arrancar solo se reproduce el resto. Si la instantánea se reconstruye
+ * desde correos.txt, se reproduce el diario completo; como los correos
+ * pueden haber cambiado de ID, cada marca de borrado lleva la huella del
+ * correo y se aplica al que la tenga.
+ *
+ * Las escrituras se agrupan: los registros se acumulan en memoria y un
+ * hilo del diario los escribe con un único fsync por lote (commit en
+ * grupo), cuando el lote se llena, cuando el primero lleva esperando
+ * INTERVALO_DIARIO o cuando alguien llama a sincronizar(), que espera a
+ * que sus registros sean durables. El hilo de mantenimiento también
+ * sincroniza periódicamente, y como las instantáneas son baratas y se
+ * guardan cada INTERVALO_INSTANTANEA, al arrancar solo se reproduce una
+ * cola corta.
+ */
+
+/// Registros pendientes que disparan una escritura del lote.
+const size_t TAM_LOTE_DIARIO = 64;
+/// Espera máxima de un registro pendiente antes de forzar la escritura.
+const chrono::milliseconds INTERVALO_DIARIO(50);
+
+/**
+ * @class Diario
+ * @brief Archivo de solo escritura al final con commit en grupo. Sus
+ *        operaciones pueden llamarse desde varios hilos.
+ *
+ * Agregar solo copia el registro al lote en memoria y le da un número de
+ * secuencia. Un hilo propio escribe el lote con su fsync sin retener el
+ * candado, así que quien agrega (por ejemplo con mutexEscritor tomado)
+ * nunca espera al disco; sincronizar() espera a que la escritura que cubre
+ * su último registro termine.
+ */
+class Diario {
+private:
+    mutable mutex m;
+    condition_variable hayTrabajo;    ///< Para el hilo escritor
+    condition_variable hayDurables;   ///< Para quienes esperan en sincronizar()
+    thread escritor;
+    int fd = -1;
+    bool detenerse = false;
+    string pendiente;
+    size_t nPendientes = 0;
+    chrono::steady_clock::time_point primeroPendiente;
+    uint64_t secuencia = 0;       ///< Registros agregados desde abrir()
+    uint64_t secDurable = 0;      ///< Registros ya durables
+    uint64_t fallos = 0;          ///< Escrituras fallidas desde abrir()
+    size_t esperando = 0;         ///< Hilos dentro de sincronizar()
+    uint64_t bytesEscritos = 0;
+    uint64_t bytesAgregados = 0;  ///< bytesEscritos más lo pendiente o en escritura
+
+    /**
+     * @brief Descarta lo escrito después de `bytes`, para que un lote que
+     *        falló a medias no quede como registro roto delante del
+     *        reintento.
+     */
+    void descartarParcial(uint64_t bytes) {
+#ifdef _WIN32
+        _chsize_s(fd, (__int64)bytes);
+#else
+        while (ftruncate(fd, (off_t)bytes) != 0 && errno == EINTR) {}
+#endif
+    }
+
+    /**
+     * @brief Escribe un lote completo al final del archivo y espera a que
+     *        sea durable. Si algo falla, el archivo vuelve a `bytes`.
+     */
+    bool escribirLote(const string& lote, uint64_t bytes) {
+        const char* p = lote.data();
+        size_t resto = lote.size();
+        while (resto > 0) {
+#ifdef _WIN32
+            int n = _write(fd, p, (unsigned)resto);
+#else
+            ssize_t n = write(fd, p, resto);
+#endif
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                descartarParcial(bytes);
+                return false;
+            }
+            p += n;
+            resto -= (size_t)n;
+        }
+#ifdef _WIN32
+        bool durable = _commit(fd) == 0;
+#else
+        int r;
+        while ((r = fsync(fd)) != 0 && errno == EINTR) {}
+        bool durable = r == 0;
+#endif
+        if (!durable) descartarParcial(bytes);
+        return durable;
+    }
+
+    /**
+     * @brief Hilo escritor: toma el lote cuando se llena, cuando el primer
+     *        registro lleva INTERVALO_DIARIO esperando, cuando alguien
+     *        sincroniza o al cerrar, y lo escribe fuera del candado. Un
+     *        lote fallido vuelve al frente de lo pendiente y se reintenta
+     *        tras INTERVALO_DIARIO.
+     */
+    void escribirLotes() {
+        unique_lock<mutex> bloqueo(m);
+        while (true) {
+            if (nPendientes == 0) {
+                if (detenerse) return;
+                hayTrabajo.wait(bloqueo);
+                continue;
+            }
+            if (!detenerse && esperando == 0 && nPendientes < TAM_LOTE_DIARIO &&
+                hayTrabajo.wait_until(bloqueo, primeroPendiente + INTERVALO_DIARIO) ==
+                    cv_status::no_timeout)
+                continue;
+
+            string lote = move(pendiente);
+            pendiente.clear();
+            size_t nLote = nPendientes;
+            nPendientes = 0;
+            uint64_t hasta = secuencia, bytes = bytesEscritos;
+            bloqueo.unlock();
+            bool ok = escribirLote(lote, bytes);
+            bloqueo.lock();
+
+            if (ok) {
+                bytesEscritos += lote.size();
+                secDurable = hasta;
+            } else {
+                fallos++;
+                pendiente.insert(0, lote);
+                nPendientes += nLote;
+                primeroPendiente = chrono::steady_clock::now();
+            }
+            hayDurables.notify_all();
+            // Al cerrar no se reintenta sin fin: sincronizar() ya informó
+            if (!ok && detenerse) return;
+            if (!ok) hayTrabajo.wait_for(bloqueo, INTERVALO_DIARIO);
+        }
+    }
+
+    void registroAgregado() {
+        if (nPendientes == 0) primeroPendiente = chrono::steady_clock::now();
+        nPendientes++;
+        secuencia++;
+        if (nPendientes == 1 || nPendientes >= TAM_LOTE_DIARIO) hayTrabajo.notify_one();
+    }
+
+public:
+    Diario() = default;
+    Diario(const Diario&) = delete;
+    Diario& operator=(const Diario&) = delete;
+
+    ~Diario() { cerrar(); }
+
+    /**
+     * @brief Abre el diario para agregar al final, creándolo si no existe,
+     *        y lanza el hilo escritor.
+     * @return false si no se pudo abrir.
+     */
+    bool abrir(const string& nombreArchivo) {
+        lock_guard<mutex> bloqueo(m);
+#ifdef _WIN32
+        fd = _open(nombreArchivo.c_str(), _O_WRONLY | _O_APPEND | _O_CREAT | _O_BINARY,
+                   _S_IREAD | _S_IWRITE);
+#else
+        fd = open(nombreArchivo.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+#endif
+        if (fd < 0) return false;
+        error_code ec;
+        bytesEscritos = bytesAgregados = filesystem::file_size(nombreArchivo, ec);
+        detenerse = false;
+        escritor = thread(&Diario::escribirLotes, this);
+        return true;
+    }
+
+    /**
+     * @brief Bytes del diario que ya son durables.
+     */
+    uint64_t tamano() const {
+        lock_guard<mutex> bloqueo(m);
+        return bytesEscritos;
+    }
+
+    /**
+     * @brief Agrega un correo al lote pendiente. No espera al disco.
+     */
+    void agregar(const Correo& c) {
+        lock_guard<mutex> bloqueo(m);
+        if (fd < 0) return;
+        size_t antes = pendiente.size();
+        serializarRegistro(pendiente, c);
+        bytesAgregados += pendiente.size() - antes;
+        registroAgregado();
+    }
+
+    /**
+     * @brief Agrega la marca de borrado de un correo al lote pendiente.
+     */
+    void agregarBorrado(int id, uint64_t huella) {
+        lock_guard<mutex> bloqueo(m);
+        if (fd < 0) return;
+        size_t antes = pendiente.size();
+        serializarBorrado(pendiente, id, huella);
+        bytesAgregados += pendiente.size() - antes;
+        registroAgregado();
+    }
+
+    /**
+     * @brief Posición del final de lo agregado hasta ahora.
+     * @param sec Recibe el número de secuencia del último registro, para
+     *        esperar() a que sea durable.
+     * @return Bytes que tendrá el diario cuando lo sea.
+     */
+    uint64_t posicion(uint64_t& sec) const {
+        lock_guard<mutex> bloqueo(m);
+        sec = secuencia;
+        return bytesAgregados;
+    }
+
+    /**
+     * @brief Espera a que todo lo agregado hasta ahora llegue al disco.
+     *        Varios hilos que sincronizan a la vez comparten un fsync.
+     * @return false si la escritura falló.
+     */
+    bool sincronizar() { return esperar(UINT64_MAX); }
+
+    /**
+     * @brief Espera a que sean durables los registros hasta el número de
+     *        secuencia `objetivo` (o todos los agregados, si es mayor).
+     * @return false si la escritura falló.
+     */
+    bool esperar(uint64_t objetivo) {
+        unique_lock<mutex> bloqueo(m);
+        if (fd < 0) return true;
+        objetivo = min(objetivo, secuencia);
+        uint64_t fallosAntes = fallos;
+        esperando++;
+        hayTrabajo.notify_one();
+        hayDurables.wait(bloqueo, [&] { return secDurable >= objetivo || fallos != fallosAntes; });
+        esperando--;
+        return secDurable >= objetivo;
+    }
+
+    /// Escribe lo pendiente, detiene el hilo escritor y cierra el archivo.
+    void cerrar() {
+        {
+            lock_guard<mutex> bloqueo(m);
+            if (fd < 0) return;
+            detenerse = true;
+        }
+        hayTrabajo.notify_one();
+        escritor.join();
+        lock_guard<mutex> bloqueo(m);
+#ifdef _WIN32
+        _close(fd);
+#else
+        close(fd);
+#endif
+        fd = -1;
+    }
+};
+
+/// Diario en el que se anotan los correos creados y borrados (nullptr = ninguno).
+Diario* diarioActivo = nullptr;
+
+void anotarEnDiario(const Correo& c) {
+    if (diarioActivo) diarioActivo->agregar(c);
+}
+
+void anotarBorradoEnDiario(int id) {
+    if (diarioActivo) diarioActivo->agregarBorrado(id, huellaCorreo(*almacenCorreos.buscar(id)));
+}
+
+/**
+ * @brief Posición del final de lo anotado en el diario activo (0 si no hay
+ *        diario). Requiere mutexEscritor para que coincida con la vista.
+ * @param secuencia Recibe el número de secuencia del último registro.
+ */
+uint64_t posicionDiario(uint64_t& secuencia) {
+    secuencia = 0;
+    return diarioActivo ? diarioActivo->posicion(secuencia) : 0;
+}
+
+/**
+ * @brief Espera a que el diario activo sea durable hasta `secuencia`.
+ * @return false si la escritura falló.
+ */
+bool esperarDiario(uint64_t secuencia) {
+    return !diarioActivo || diarioActivo->esperar(secuencia);
+}
+
+/**
+ * @class BorradosPorHuella
+ * @brief Aplica las marcas de borrado del diario al correo vigente con su
+ *        huella: el del ID anotado si coincide, o si no cualquiera con la
+ *        misma huella. El mapa de huellas se arma solo al primer desacuerdo.
+ */
+class BorradosPorHuella {
+private:
+    unordered_map<uint64_t, vector<int>> ids;
+    bool armado = false;
+
+public:
+    /// Registra un correo creado después de armar el mapa.
+    void agregado(const Correo& c) {
+        if (armado) ids[huellaCorreo(c)].push_back(c.id);
+    }
+
+    /**
+     * @return false si ningún correo vigente tiene esa huella.
+     */
+    bool borrar(int id, uint64_t huella) {
+        const Correo* c = buscarPorID(id);
+        if (c && huellaCorreo(*c) == huella) return borrarCorreo(id);
+        if (!armado) {
+            armado = true;
+            for (int i = 1; (size_t)i <= almacenCorreos.tamano(); i++)
+                if (const Correo* x = buscarPorID(i)) ids[huellaCorreo(*x)].push_back(i);
+        }
+        auto it = ids.find(huella);
+        if (it == ids.end()) return false;
+        for (int candidato : it->second)
+            if (buscarPorID(candidato)) return borrarCorreo(candidato);
+        return false;
+    }
+};
+
+/**
+ * @brief Reproduce los correos y borrados del diario a partir del byte
+ *        `desde`. Si el final quedó incompleto (por ejemplo, por un corte
+ *        durante una escritura), se descarta esa cola para que nuevas
+ *        anotaciones no queden detrás de basura.
+ *        Los correos reproducidos se publican al terminar.
+ * @param renumerado Si los índices se reconstruyeron desde correos.txt: las
+ *        marcas sin huella ya no identifican al correo y se omiten.
+ * @param recortado Si no es nulo, recibe si se descartó una cola incompleta.
+ * @param omitidos Si no es nulo, recibe cuántos borrados no se aplicaron
+ *        porque su correo ya no existe o no se pudo identificar.
+ * @return Cantidad de registros reproducidos.
+ */
+int reproducirDiario(const string& nombreArchivo, uint64_t desde, bool renumerado,
+                     bool* recortado = nullptr, int* omitidos = nullptr) {
+    int reproducidos = 0, sinCorreo = 0;
+    size_t valido = 0;
+    BorradosPorHuella porHuella;
+    {
+        ArchivoMapeado archivo(nombreArchivo);
+        if (!archivo.abierto()) return 0;
+        string_view contenido = archivo.contenido();
+        if (desde > contenido.size()) desde = contenido.size();
+
+        LectorRegistros lector(contenido.substr(desde));
+        CamposCorreo campos;
+        valido = desde;
+        while (!lector.fin()) {
+            int id = 0;
+            uint64_t huella = 0;
+            bool borrado = lector.esBorrado();
+            EstadoRegistro estado =
+                borrado ? lector.leerBorrado(id, huella) : lector.siguiente(campos);
+            if (estado == REGISTRO_INVALIDO) break;
+            if (estado == REGISTRO_VALIDO) {
+                if (!borrado)
+                    porHuella.agregado(crearCorreo(campos.rem, campos.asu, campos.cue, campos.fecha));
+                else if (huella != 0 ? !porHuella.borrar(id, huella) : renumerado || !borrarCorreo(id))
+                    sinCorreo++;
+                reproducidos++;
+            }
+            valido = lector.fin() ? contenido.size()
+                                  : (size_t)(lector.posicion() - contenido.data());
+        }
+    }
+    publicarCorreos();
+
+    error_code ec;
+    bool incompleto = valido < filesystem::file_size(nombreArchivo, ec) && !ec;
+    if (incompleto) filesystem::resize_file(nombreArchivo, valido, ec);
+    if (recortado) *recortado = incompleto;
+    if (omitidos) *omitidos = sinCorreo;
+    return reproducidos;
+}
+
+// ============================================================================
+// MANTENIMIENTO EN SEGUNDO PLANO
+// ============================================================================
+/*
+ * Un hilo despierta cada INTERVALO_MANTENIMIENTO y:
+ *  - publica el segmento abierto si tiene correos de hace más de
+ *    INTERVALO_PUBLICACION, y escribe lo pendiente del diario;
+ *  - fusiona grupos de segmentos del mismo nivel mientras los haya, y
+ *    reescribe sin sus borrados los segmentos que superan
+ *    UMBRAL_COMPACTACION;
+ *  - guarda la instantánea si la vista cambió y pasó INTERVALO_INSTANTANEA
+ *    desde la anterior.
+ * Las fusiones se arman sin candados, a partir de segmentos inmutables;
+ * mutexEscritor solo se toma para reemplazarlos en la vista, así que los
+ * escritores no esperan a que termine una fusión.
+ */
+
+const chrono::milliseconds INTERVALO_MANTENIMIENTO(100);
+/// Demora máxima para que un correo creado sea visible en las búsquedas.
+const chrono::milliseconds INTERVALO_PUBLICACION(500);
+const chrono::seconds INTERVALO_INSTANTANEA(30);
+
+/**
+ * @class Mantenimiento
+ * @brief Hilo que publica, fusiona y compacta segmentos y guarda
+ *        instantáneas.
+ */
+class Mantenimiento {
+private:
+    thread hilo;
+    mutex m;
+    condition_variable despertar;
+    atomic<bool> detenerse{false};
+    string instantanea;
+    chrono::steady_clock::time_point ultimaInstantanea;
+
+    void publicarVencidos() {
+        {
+            lock_guard<mutex> bloqueo(mutexEscritor);
+            if (segmentoAbierto && segmentoAbierto->nCorreos > 0 &&
+                chrono::steady_clock::now() - segmentoAbiertoDesde >= INTERVALO_PUBLICACION)
+                publicarSegmentoAbierto();
+        }
+        esperarDiario(UINT64_MAX);
+    }
+
+    void fusionarPendientes() {
+        while (!detenerse) {
+            GrupoFusion grupo = elegirFusion(*vistaActual());
+            if (grupo.segmentos.empty()) return;
+            instalarFusion(grupo, fusionarSegmentos(grupo));
+        }
+    }
+
+    void guardarSiCambio() {
+        if (instantanea.empty() || vistaActual()->generacion == generacionGuardada) return;
+        auto ahora = chrono::steady_clock::now();
+        if (ahora - ultimaInstantanea < INTERVALO_INSTANTANEA) return;
+        // Si falla se reintenta en el siguiente intervalo
+        guardarInstantanea(instantanea);
+        ultimaInstantanea = ahora;
+    }
+
+    void ciclo() {
+        unique_lock<mutex> bloqueo(m);
+        while (!detenerse) {
+            despertar.wait_for(bloqueo, INTERVALO_MANTENIMIENTO);
+            if (detenerse) break;
+            bloqueo.unlock();
+            publicarVencidos();
+            fusionarPendientes();
+            guardarSiCambio();
+            bloqueo.lock();
+        }
+    }
+
+public:
+    Mantenimiento() = default;
+    Mantenimiento(const Mantenimiento&) = delete;
+    Mantenimiento& operator=(const Mantenimiento&) = delete;
+
+    ~Mantenimiento() { detener(); }
+
+    /**
+     * @brief Lanza el hilo.
+     * @param archivoInstantanea Instantánea a mantener al día ("" = ninguna).
+     */
+    void iniciar(const string& archivoInstantanea) {
+        if (hilo.joinable()) return;
+        instantanea = archivoInstantanea;
+        ultimaInstantanea = chrono::steady_clock::now();
+        detenerse = false;
+        hilo = thread(&Mantenimiento::ciclo, this);
+    }
+
+    /**
+     * @brief Detiene el hilo y espera a que termine; una fusión en curso se
+     *        completa antes.
+     */
+    void detener() {
+        if (!hilo.joinable()) return;
+        {
+            lock_guard<mutex> bloqueo(m);
+            detenerse = true;
+        }
+        despertar.notify_one();
+        hilo.join();
+    }
+};
+
+Mantenimiento mantenimiento;
+
+// ============================================================================
+// MOTOR DE BÚSQUEDA
+// ============================================================================
+/**
+ * @struct ConfiguracionMotor
+ * @brief Archivos y opciones con que arranca el motor de búsqueda.
+ */
+struct ConfiguracionMotor {
+    string archivoCorreos = "correos.txt";
+    string archivoInstantanea = "correos.idx";
+    string archivoDiario = "correos.wal";
+    string archivoCuerpos;             ///< Almacén de cuerpos en disco ("" = en memoria)
+    unsigned hilosCarga = 0;           ///< Hilos para cargar archivoCorreos (0 = todos)
+    bool mantenimiento = true;         ///< Lanzar el hilo de mantenimiento
+};
+
+/**
+ * @class Resultados
+ * @brief Tramo de los resultados de una búsqueda. Comparte el resultado
+ *        guardado en la caché de consultas, así que copiarlo o tomar una
+ *        página no copia los IDs.
+ */
+class Resultados {
+private:
+    shared_ptr<const ResultadoConsulta> datos;
+    size_t inicio = 0, fin = 0;
+
+public:
+    Resultados() = default;
+    explicit Resultados(shared_ptr<const ResultadoConsulta> d)
+        : datos(move(d)), fin(datos->resultados.size()) {}
+
+    size_t tamano() const { return fin - inicio; }
+    bool vacio() const { return inicio == fin; }
+
+    /// Coincidencias de toda la búsqueda, que puede superar a tamano(). En
+    /// algunas disyunciones es una estimación (ver totalAproximado()).
+    size_t total() const { return datos ? max(datos->total, datos->resultados.size()) : 0; }
+
+    /// Si total() es una estimación; MotorBusqueda::contar() da el exacto.
+    bool totalAproximado() const { return datos && datos->totalAproximado; }
+
+    const ResultadoRanking& operator[](size_t i) const { return datos->resultados[inicio + i]; }
+    const ResultadoRanking* begin() const { return datos ? datos->resultados.data() + inicio : nullptr; }
+    const ResultadoRanking* end() const { return datos ? datos->resultados.data() + fin : nullptr; }
+
+    /**
+     * @brief Hasta `cantidad` resultados a partir de la posición `desde`.
+     */
+    Resultados tramo(size_t desde, size_t cantidad) const {
+        Resultados r = *this;
+        r.inicio = min(fin, inicio + desde);
+        r.fin = min(fin, r.inicio + cantidad);
+        return r;
+    }
+};
+
+/**
+ * @class MotorBusqueda
+ * @brief Punto de entrada a los índices, sin entrada ni salida por consola:
+ *        arranca desde la instantánea, el diario y el archivo de correos,
+ *        agrega, borra y edita correos y responde las búsquedas.
+ *
+ * Las consultas pueden hacerse desde varios hilos a la vez y no se bloquean
+ * con las escrituras; las escrituras se serializan entre sí. Los índices
+ * son globales del proceso, así que puede haber un solo motor abierto. Los
+ * errores de arranque que no lo impiden quedan en avisos().
+ */
+class MotorBusqueda {
+private:
+    ConfiguracionMotor config;
+    Diario diario;
+    vector<string> listaAvisos;
+    size_t correosIniciales = 0;
+    bool abierto = false;
+
+public:
+    MotorBusqueda() = default;
+    MotorBusqueda(const MotorBusqueda&) = delete;
+    MotorBusqueda& operator=(const MotorBusqueda&) = delete;
+
+    ~MotorBusqueda() { cerrar(); }
+
+    /**
+     * @brief Carga los índices: desde la instantánea si está al día o
+     *        reconstruyéndolos desde el archivo de correos, y luego aplica
+     *        el diario.
+     * @return false si ya había un motor abierto.
+     */
+    bool abrir(const ConfiguracionMotor& configuracion) {
+        if (abierto) return false;
+        config = configuracion;
+        listaAvisos.clear();
+        uint64_t bytesDiario = 0;
+
+        // Con almacén de cuerpos los cuerpos no ocupan memoria: se leen de
+        // él al abrir cada correo
+        if (!config.archivoCuerpos.empty() && !almacenCuerpos.abrir(config.archivoCuerpos))
+            listaAvisos.push_back("No se pudo abrir el almacen de cuerpos; quedaran en memoria.");
+
+        // Si hay una instantánea al día, se evita reconstruir los índices
+        bool reconstruido = !instantaneaVigente(config.archivoInstantanea, config.archivoCorreos) ||
+                            !cargarInstantanea(config.archivoInstantanea, bytesDiario);
+        if (reconstruido) {
+            bytesDiario = 0;
+            if (almacenCuerpos.activo() && !almacenCuerpos.truncar())
+                listaAvisos.push_back("No se pudo vaciar el almacen de cuerpos.");
+
+            // Correos predefinidos
+            crearCorreo("juan@correo.com", "Reunion de equipo", "Reunion urgente mañana",
+                        empaquetarFecha(2025, 11, 10));
+            crearCorreo("ana@correo.com", "Entrega de tarea", "La tarea esta lista",
+                        empaquetarFecha(2025, 11, 11));
+            crearCorreo("luis@correo.com", "Proyecto nuevo", "Debemos entregar el reporte",
+                        empaquetarFecha(2025, 11, 9));
+
+            // Carga de archivo externo
+            int malFormados = cargarCorreosDesdeArchivo(config.archivoCorreos, config.hilosCarga);
+            if (malFormados < 0)
+                listaAvisos.push_back("No se pudo abrir el archivo " + config.archivoCorreos + ".");
+            else if (malFormados > 0)
+                listaAvisos.push_back("Se omitieron " + to_string(malFormados) +
+                                      " registros mal formados.");
+            publicarCorreos();
+        }
+
+        // Correos creados o borrados en ejecuciones anteriores y aún no incluidos
+        bool recortado = false;
+        int omitidos = 0;
+        int reproducidos =
+            reproducirDiario(config.archivoDiario, bytesDiario, reconstruido, &recortado, &omitidos);
+        if (recortado) listaAvisos.push_back("Se descarto el final incompleto del diario.");
+        if (omitidos > 0)
+            listaAvisos.push_back("Se omitieron " + to_string(omitidos) +
+                                  " borrados del diario cuyo correo ya no existe.");
+
+        if (diario.abrir(config.archivoDiario))
+            diarioActivo = &diario;
+        else
+            listaAvisos.push_back("No se pudo abrir el diario; los correos nuevos no se guardaran.");
+
+        if ((reconstruido || reproducidos > 0) && !guardarInstantanea(config.archivoInstantanea))
+            listaAvisos.push_back("No se pudo guardar la instantanea de indices.");
+
+        correosIniciales = almacenCorreos.tamano();
+
+        // Publicación periódica, fusiones de segmentos e instantáneas
+        if (config.mantenimiento) mantenimiento.iniciar(config.archivoInstantanea);
+        abierto = true;
+        return true;
+    }
+
+    /**
+     * @brief Detiene el mantenimiento, escribe el diario y guarda la
+     *        instantánea si los índices cambiaron.
+     */
+    void cerrar() {
+        if (!abierto) return;
+        // Los correos nuevos ya están en el diario; la instantánea solo
+        // acelera el próximo arranque
+        mantenimiento.detener();
+        diario.sincronizar();
+        if (almacenCorreos.tamano() != correosIniciales ||
+            vistaActual()->generacion != generacionGuardada)
+            guardarInstantanea(config.archivoInstantanea);
+        diarioActivo = nullptr;
+        abierto = false;
+    }
+
+    /// Problemas del arranque que no lo impidieron.
+    const vector<string>& avisos() const { return listaAvisos; }
+
+    /**
+     * @brief Crea e indexa un correo. Es visible en las búsquedas tras
+     *        confirmar() o, a lo sumo, INTERVALO_PUBLICACION después.
+     */
+    const Correo& agregar(string_view rem, string_view asu, string_view cue, Fecha fecha) {
+        return crearCorreo(rem, asu, cue, fecha);
+    }
+
+    /**
+     * @brief Borra un correo.
+     * @return false si no existe o ya estaba borrado.
+     */
+    bool borrar(int id) { return borrarCorreo(id); }
+
+    /**
+     * @brief Reemplaza un correo por otro con los datos dados.
+     * @return El correo nuevo, o nullptr si `id` no existe.
+     */
+    const Correo* editar(int id, string_view rem, string_view asu, string_view cue, Fecha fecha) {
+        return actualizarCorreo(id, rem, asu, cue, fecha);
+    }
+
+    /**
+     * @brief Hace visibles los cambios hechos hasta ahora y espera a que
+     *        lleguen al diario en disco.
+     * @return false si no se pudieron guardar.
+     */
+    bool confirmar() {
+        publicarCorreos();
+        return !diarioActivo || diarioActivo->sincronizar();
+    }
+
+    /**
+     * @brief Los `k` correos más relevantes para una consulta booleana, de
+     *        mayor a menor puntaje BM25.
+     */
+    Resultados buscar(string_view consulta, size_t k = TAM_RANKING) const {
+        MedirLatencia medir(OP_BUSCAR);
+        ConsultaBooleana q(consulta);
+        return Resultados(relevantesEnCache(*vistaActual(), q, k));
+    }
+
+    /**
+     * @brief Cantidad exacta de correos que cumplen una consulta booleana,
+     *        para cuando buscar() la da aproximada. No usa la caché y en
+     *        las disyunciones recorre las listas completas.
+     */
+    size_t contar(string_view consulta) const {
+        ConsultaBooleana q(consulta);
+        return contarCoincidencias(*vistaActual(), q);
+    }
+
+    /**
+     * @brief Términos parecidos a los de la consulta que no están en el
+     *        índice, para sugerirlos cuando no hay resultados.
+     * @return Pares (término, términos indexados parecidos).
+     */
+    vector<pair<string, vector<string>>> sugerencias(string_view consulta) const {
+        shared_ptr<const VistaIndice> vista = vistaActual();
+        vector<pair<string, vector<string>>> out;
+        for (const string& t : ConsultaBooleana(consulta).terminos()) {
+            if (terminoIndexado(*vista, t)) continue;
+            vector<string> similares =
+                terminosSimilares(*vista, t, MAX_DISTANCIA_SUGERENCIA, MAX_SUGERENCIAS);
+            if (!similares.empty()) out.push_back({t, move(similares)});
+        }
+        return out;
+    }
+
+    /**
+     * @brief Correos de los remitentes que calzan con `patron` (dirección,
+     *        "@dominio" o "comienzo*"), en orden de fecha.
+     */
+    Resultados porRemitente(string_view patron) const {
+        MedirLatencia medir(OP_REMITENTE);
+        return Resultados(remitentesEnCache(*vistaActual(), patron));
+    }
+
+    /**
+     * @brief Cursor sobre los correos con fecha en [desde, hasta), en orden
+     *        de fecha. Recorre la vista del momento en que se pidió.
+     */
+    CursorFechas porFechas(Fecha desde = 0, Fecha hasta = FECHA_MAXIMA) const {
+        return CursorFechas(vistaActual(), desde, hasta);
+    }
+
+    /// Correo con ese ID, o nullptr si no existe o está borrado.
+    const Correo* correo(int id) const { return buscarPorID(id); }
+
+    /// Correo de un resultado, aunque se haya borrado después de la búsqueda.
+    const Correo& correo(const ResultadoRanking& r) const { return *almacenCorreos.buscar(r.id); }
+
+    /// Cuerpo de un correo, esté en memoria o en el almacén de cuerpos.
+    string cuerpo(const Correo& c) const { return cuerpoDe(c); }
+};
+
+/**
+ * @struct TamanosIndice
+ * @brief Tamaño de los índices de una vista. Los términos y remitentes se
+ *        cuentan una vez por segmento en que aparecen.
+ */
+struct TamanosIndice {
+    size_t segmentos = 0;
+    size_t correos = 0;
+    size_t borrados = 0;
+    size_t terminos = 0;        ///< Del índice de texto completo
+    size_t remitentes = 0;
+    size_t postings = 0;        ///< De los tres índices de campo
+    size_t bytesPostings = 0;
+};
+
+TamanosIndice tamanosIndice(const VistaIndice& vista) {
+    TamanosIndice t;
+    t.segmentos = vista.segmentos.size();
+    t.correos = (size_t)vista.nCorreos;
+    for (size_t i = 0; i < vista.segmentos.size(); i++) {
+        const Segmento& s = *vista.segmentos[i];
+        if (vista.borrados[i]) t.borrados += (size_t)vista.borrados[i]->tamano();
+        t.terminos += s.texto.tamano();
+        t.remitentes += s.remitentes.tamano();
+        for (const IndiceCampo* campo : {&s.texto, &s.asunto, &s.remitente}) {
+            for (const ListaPostings& lista : campo->postings) {
+                t.postings += lista.tamano();
+                t.bytesPostings += lista.bytes();
+            }
+        }
+    }
+    return t;
+}
+
+/**
+ * @brief Informe legible de las latencias medidas, los índices publicados,
+ *        la caché de consultas y las asignaciones de memoria.
+ */
+string informeEstadisticas() {
+    string out = "Latencias:\n" + encabezadoLatencias();
+    for (int op = 0; op < NUM_OPERACIONES; op++) {
+        if (latencias[op].muestras() > 0) out += filaLatencia(NOMBRES_OPERACIONES[op], latencias[op]);
+    }
+    TamanosIndice t = tamanosIndice(*vistaActual());
+    auto [entradas, bytesCache] = cacheConsultas.ocupacion();
+    out += "Indices:\n";
+    out += "  correos " + to_string(t.correos) + " (" + to_string(t.borrados) + " borrados) en " +
+           to_string(t.segmentos) + " segmentos\n";
+    out += "  terminos " + to_string(t.terminos) + ", remitentes " + to_string(t.remitentes) + "\n";
+    out += "  postings " + to_string(t.postings) + " en " + to_string(t.bytesPostings) + " bytes\n";
+    out += "Cache de consultas: " + to_string(cacheConsultas.aciertos()) + " aciertos, " +
+           to_string(cacheConsultas.fallos()) + " fallos, " + to_string(entradas) + " entradas (" +
+           to_string(bytesCache) + " bytes)\n";
+    if (CONTAR_ASIGNACIONES)
+        out += "Asignaciones: " + to_string(asignaciones.load(memory_order_relaxed)) + " (" +
+               to_string(bytesAsignados.load(memory_order_relaxed)) + " bytes)\n";
+    else
+        out += "Asignaciones: n/a (compilar con -DBUSCADOR_CONTAR_ASIGNACIONES)\n";
+    return out;
+}
+
+/**
+ * @brief Lo mismo que informeEstadisticas() como objeto JSON, con las
+ *        duraciones en nanosegundos y `asignaciones` en null si no se
+ *        cuentan.
+ */
+string estadisticasJSON() {
+    string out = "{\"latencias\":{";
+    bool primero = true;
+    for (int op = 0; op < NUM_OPERACIONES; op++) {
+        const HistogramaLatencia& h = latencias[op];
+        if (h.muestras() == 0) continue;
+        if (!primero) out += ',';
+        primero = false;
+        out += string("\"") + NOMBRES_OPERACIONES[op] + "\":{\"muestras\":" + to_string(h.muestras()) +
+               ",\"media\":" + to_string(h.media()) + ",\"p50\":" + to_string(h.percentil(0.5)) +
+               ",\"p99\":" + to_string(h.percentil(0.99)) + ",\"max\":" + to_string(h.maximo()) + "}";
+    }
+    TamanosIndice t = tamanosIndice(*vistaActual());
+    auto [entradas, bytesCache] = cacheConsultas.ocupacion();
+    out += "},\"indices\":{\"segmentos\":" + to_string(t.segmentos) +
+           ",\"correos\":" + to_string(t.correos) + ",\"borrados\":" + to_string(t.borrados) +
+           ",\"terminos\":" + to_string(t.terminos) + ",\"remitentes\":" + to_string(t.remitentes) +
+           ",\"postings\":" + to_string(t.postings) + ",\"bytesPostings\":" + to_string(t.bytesPostings) +
+           "},\"cache\":{\"aciertos\":" + to_string(cacheConsultas.aciertos()) +
+           ",\"fallos\":" + to_string(cacheConsultas.fallos()) + ",\"entradas\":" + to_string(entradas) +
+           ",\"bytes\":" + to_string(bytesCache) + "},\"asignaciones\":";
+    if (CONTAR_ASIGNACIONES)
+        out += "{\"cantidad\":" + to_string(asignaciones.load(memory_order_relaxed)) +
+               ",\"bytes\":" + to_string(bytesAsignados.load(memory_order_relaxed)) + "}";
+    else
+        out += "null";
+    out += '}';
+    return out;
+}
+
+// ============================================================================
+// MODO POR LOTES
+// ============================================================================
+/**
+ * @class ReservaHilos
+ * @brief Hilos fijos que ejecutan tareas de una cola compartida.
+ */
+class ReservaHilos {
+private:
+    vector<thread> hilos;
+    mutex m;
+    condition_variable hayTarea, sinPendientes;
+    deque<function<void()>> tareas;
+    size_t pendientes = 0;   ///< Encoladas o en ejecución
+    bool detenerse = false;
+
+    void trabajar() {
+        unique_lock<mutex> bloqueo(m);
+        while (true) {
+            hayTarea.wait(bloqueo, [&] { return detenerse || !tareas.empty(); });
+            if (tareas.empty()) return;
+            function<void()> tarea = move(tareas.front());
+            tareas.pop_front();
+            bloqueo.unlock();
+            tarea();
+            bloqueo.lock();
+            if (--pendientes == 0) sinPendientes.notify_all();
+        }
+    }
+
+public:
+    /**
+     * @param n Cantidad de hilos (0 = según los núcleos disponibles).
+     */
+    explicit ReservaHilos(unsigned n = 0) {
+        if (n == 0) n = max(1u, thread::hardware_concurrency());
+        for (unsigned i = 0; i < n; i++) hilos.emplace_back(&ReservaHilos::trabajar, this);
+    }
+
+    ReservaHilos(const ReservaHilos&) = delete;
+    ReservaHilos& operator=(const ReservaHilos&) = delete;
+
+    /// Termina las tareas encoladas y espera a los hilos.
+    ~ReservaHilos() {
+        {
+            lock_guard<mutex> bloqueo(m);
+            detenerse = true;
+        }
+        hayTarea.notify_all();
+        for (thread& h : hilos) h.join();
+    }
+
+    size_t tamano() const { return hilos.size(); }
+
+    void encolar(function<void()> tarea) {
+        {
+            lock_guard<mutex> bloqueo(m);
+            tareas.push_back(move(tarea));
+            pendientes++;
+        }
+        hayTarea.notify_one();
+    }
+
+    /// Espera a que terminen todas las tareas encoladas hasta ahora.
+    void esperar() {
+        unique_lock<mutex> bloqueo(m);
+        sinPendientes.wait(bloqueo, [&] { return pendientes == 0; });
+    }
+};
+
+/**
+ * @struct OpcionesLote
+ * @brief Cómo responde ejecutarLote().
+ */
+struct OpcionesLote {
+    bool json = false;            ///< Una línea JSON por consulta en vez de los IDs
+    size_t limite = TAM_RANKING;  ///< Resultados por consulta
+    unsigned hilos = 0;           ///< 0 = según los núcleos disponibles
+};
+
+/// Líneas que se leen y responden juntas antes de escribir la salida.
+const size_t TAM_VENTANA_LOTE = 4096;
+/// Líneas de cada tarea de la reserva de hilos.
+const size_t TAM_TAREA_LOTE = 64;
+
+/**
+ * @brief Texto entre comillas con los escapes de JSON.
+ */
+string textoJSON(string_view s) {
+    string out = "\"";
+    for (char ch : s) {
+        if (ch == '"' || ch == '\\') {
+            out += '\\';
+            out += ch;
+        } else if ((unsigned char)ch < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof escape, "\\u%04x", (unsigned char)ch);
+            out += escape;
+        } else {
+            out += ch;
+        }
+    }
+    return out + "\"";
+}
+
+/**
+ * @brief Responde una línea del lote y agrega la respuesta, terminada en
+ *        salto de línea, a `out`.
+ *
+ * La línea es una consulta booleana, "remitente: <patrón>" o
+ * "fechas: <desde> [<hasta>]" con fechas como en verOrdenados(). Sin JSON
+ * la respuesta son los IDs separados por espacios (o "ERROR <motivo>"); con
+ * JSON es {"linea", "consulta", "total", "ids"} o {"linea", "consulta",
+ * "error"}.
+ */
+void responderLinea(const MotorBusqueda& motor, string_view linea, size_t numero,
+                    const OpcionesLote& opciones, string& out) {
+    linea = recortar(linea);
+    vector<int> ids;
+    size_t total = 0;
+    const char* error = nullptr;
+
+    auto tomarResultados = [&](const Resultados& r) {
+        for (const ResultadoRanking& res : r.tramo(0, opciones.limite)) ids.push_back(res.id);
+        total = r.total();
+    };
+    if (linea.substr(0, 10) == "remitente:") {
+        tomarResultados(motor.porRemitente(recortar(linea.substr(10))));
+    } else if (linea.substr(0, 7) == "fechas:") {
+        string_view resto = recortar(linea.substr(7));
+        string_view textoDesde = cortarCampo(resto, ' ');
+        string_view textoHasta = recortar(resto);
+        Fecha desde = 0, hasta = FECHA_MAXIMA;
+        if ((!textoDesde.empty() && !leerFecha(textoDesde, desde, true)) ||
+            (!textoHasta.empty() && !leerFecha(textoHasta, hasta, true))) {
+            error = "fecha invalida";
+        } else {
+            CursorFechas cursor = motor.porFechas(desde, hasta);
+            for (; cursor.valido(); cursor.avanzar(), total++)
+                if (ids.size() < opciones.limite) ids.push_back(cursor.actual()->id);
+        }
+    } else {
+        Resultados r = motor.buscar(linea, opciones.limite);
+        tomarResultados(r);
+        // Solo la salida JSON informa el total, y se pide exacto
+        if (opciones.json && r.totalAproximado()) total = motor.contar(linea);
+    }
+
+    if (!opciones.json) {
+        if (error) {
+            out += "ERROR ";
+            out += error;
+        }
+        for (size_t i = 0; i < ids.size(); i++) {
+            if (i > 0) out += ' ';
+            out += to_string(ids[i]);
+        }
+        out += '\n';
+        return;
+    }
+    out += "{\"linea\":" + to_string(numero) + ",\"consulta\":" + textoJSON(linea);
+    if (error) {
+        out += ",\"error\":" + textoJSON(error) + "}\n";
+        return;
+    }
+    out += ",\"total\":" + to_string(total) + ",\"ids\":[";
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (i > 0) out += ',';
+        out += to_string(ids[i]);
+    }
+    out += "]}\n";
+}
+
+/**
+ * @brief Responde las consultas de `entrada`, una por línea, con una línea
+ *        de salida por cada una y en el mismo orden.
+ *
+ * Las líneas se leen por ventanas de TAM_VENTANA_LOTE; cada ventana se
+ * reparte en tareas entre los hilos de una reserva y su salida se escribe
+ * de una vez, así que la memoria no depende del largo de la entrada.
+ *
+ * @return Cantidad de consultas respondidas.
+ */
+size_t ejecutarLote(const MotorBusqueda& motor, istream& entrada, ostream& salida,
+                    const OpcionesLote& opciones) {
+    ReservaHilos reserva(opciones.hilos);
+    vector<string> lineas, respuestas;
+    size_t respondidas = 0;
+    string linea;
+
+    while (entrada) {
+        lineas.clear();
+        while (lineas.size() < TAM_VENTANA_LOTE && getline(entrada, linea))
+            lineas.push_back(move(linea));
+        if (lineas.empty()) break;
+
+        size_t tareas = (lineas.size() + TAM_TAREA_LOTE - 1) / TAM_TAREA_LOTE;
+        respuestas.assign(tareas, string());
+        for (size_t t = 0; t < tareas; t++) {
+            reserva.encolar([&, t] {
+                size_t fin = min(lineas.size(), (t + 1) * TAM_TAREA_LOTE);
+                for (size_t i = t * TAM_TAREA_LOTE; i < fin; i++)
+                    responderLinea(motor, lineas[i], respondidas + i + 1, opciones, respuestas[t]);
+            });
+        }
+        reserva.esperar();
+
+        for (const string& r : respuestas) salida.write(r.data(), (streamsize)r.size());
+        salida.flush();
+        respondidas += lineas.size();
+    }
+    return respondidas;
+}
+
+// ============================================================================
+// SERVIDOR HTTP
+// ============================================================================
+/*
+ * Con --servidor el proceso mantiene los índices cargados y responde por
+ * HTTP/1.1, de modo que varios usuarios comparten una sola copia:
+ *
+ *     GET    /buscar?q=<consulta>[&limite=N]
+ *     GET    /remitente?patron=<patrón>[&limite=N]
+ *     GET    /fechas?[desde=<fecha>][&hasta=<fecha>][&limite=N]
+ *     GET    /correo?id=N
+ *     POST   /correos      (remitente, asunto, cuerpo, fecha como formulario)
+ *     DELETE /correo?id=N
+ *
+ * Como las altas y los borrados no piden credenciales, por omisión solo se
+ * escucha en 127.0.0.1; --servidor 0.0.0.0:8080 u otra dirección expone el
+ * servidor a la red a propósito.
+ *
+ * Las respuestas son JSON. Un solo hilo atiende todos los sockets con
+ * poll() sin bloquearse; cada petición completa pasa a una ReservaHilos y,
+ * al terminar, el trabajador deja la respuesta en una cola y despierta al
+ * bucle escribiendo en un socket UDP local, que poll() vigila junto con los
+ * demás (sirve igual en Windows, donde poll() no acepta tuberías). Cada
+ * conexión tiene a lo sumo una petición en curso, así que las respuestas
+ * salen en orden aunque el cliente envíe varias seguidas.
+ */
+
+#ifdef _WIN32
+using Socket = SOCKET;
+const Socket SOCKET_INVALIDO = INVALID_SOCKET;
+
+void cerrarSocket(Socket s) { closesocket(s); }
+
+bool sinBloqueo(Socket s) {
+    u_long si = 1;
+    return ioctlsocket(s, FIONBIO, &si) == 0;
+}
+
+int esperarSockets(vector<pollfd>& sockets, int milisegundos) {
+    return WSAPoll(sockets.data(), (ULONG)sockets.size(), milisegundos);
+}
+
+/// Si la última operación falló solo porque habría bloqueado.
+bool reintentable() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+#else
+using Socket = int;
+const Socket SOCKET_INVALIDO = -1;
+
+void cerrarSocket(Socket s) { close(s); }
+
+bool sinBloqueo(Socket s) {
+    int banderas = fcntl(s, F_GETFL, 0);
+    return banderas >= 0 && fcntl(s, F_SETFL, banderas | O_NONBLOCK) == 0;
+}
+
+int esperarSockets(vector<pollfd>& sockets, int milisegundos) {
+    return poll(sockets.data(), (nfds_t)sockets.size(), milisegundos);
+}
+
+/// Si la última operación falló solo porque habría bloqueado.
+bool reintentable() { return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR; }
+#endif
+
+/// Bytes máximos de las cabeceras de una petición.
+const size_t MAX_CABECERAS_HTTP = 16 << 10;
+/// Bytes máximos del cuerpo de una petición.
+const size_t MAX_CUERPO_HTTP = 1 << 20;
+/// Resultados máximos que devuelve una búsqueda por HTTP.
+const size_t MAX_LIMITE_HTTP = 1000;
+/// Cada cuánto revisa el bucle si debe detenerse.
+const int ESPERA_BUCLE_MS = 200;
+
+/**
+ * @struct PeticionHTTP
+ * @brief Petición ya separada: método, ruta y parámetros de la URL y del
+ *        formulario del cuerpo, decodificados.
+ */
+struct PeticionHTTP {
+    string metodo;
+    string ruta;
+    unordered_map<string, string> parametros;
+    bool mantener = true;   ///< Conservar la conexión después de responder
+
+    /// Parámetro o "" si no vino.
+    string parametro(const string& nombre) const {
+        auto it = parametros.find(nombre);
+        return it == parametros.end() ? "" : it->second;
+    }
+};
+
+int valorHexadecimal(char ch) {
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    ch = (char)tolower((unsigned char)ch);
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    return -1;
+}
+
+/**
+ * @brief Decodifica un componente de URL o de formulario ("%C3%B1", '+').
+ */
+string decodificarURL(string_view s) {
+    string out;
+    for (size_t i = 0; i < s.size(); i++) {
+        int alto = -1, bajo = -1;
+        if (s[i] == '%' && i + 2 < s.size()) {
+            alto = valorHexadecimal(s[i + 1]);
+            bajo = valorHexadecimal(s[i + 2]);
+        }
+        if (s[i] == '+') {
+            out += ' ';
+        } else if (alto >= 0 && bajo >= 0) {
+            out += (char)(alto * 16 + bajo);
+            i += 2;
+        } else {
+            out += s[i];
+        }
+    }
+    return out;
+}
+
+/**
+ * @brief Agrega los pares "nombre=valor&..." de una URL o formulario.
+ */
+void leerParametros(string_view texto, unordered_map<string, string>& parametros) {
+    while (!texto.empty()) {
+        string_view par = cortarCampo(texto, '&');
+        if (par.empty()) continue;
+        size_t igual = par.find('=');
+        string nombre = decodificarURL(par.substr(0, igual));
+        string valor = igual == string_view::npos ? "" : decodificarURL(par.substr(igual + 1));
+        parametros[nombre] = move(valor);
+    }
+}
+
+/// Compara sin distinguir mayúsculas (nombres de cabeceras).
+bool igualesSinMayusculas(string_view a, string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++)
+        if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i])) return false;
+    return true;
+}
+
+/**
+ * @brief Separa la primera petición de `datos`.
+ * @param largo Recibe los bytes que ocupa la petición.
+ * @return 0 si todavía falta parte de ella, 200 si está completa y si no
+ *         el código HTTP del error.
+ */
+int analizarPeticion(string_view datos, PeticionHTTP& p, size_t& largo) {
+    size_t finCabeceras = datos.find("\r\n\r\n");
+    if (finCabeceras == string_view::npos) return datos.size() > MAX_CABECERAS_HTTP ? 431 : 0;
+    if (finCabeceras > MAX_CABECERAS_HTTP) return 431;
+
+    string_view cabeceras = datos.substr(0, finCabeceras + 2);
+    string_view inicial = cortarCampo(cabeceras, '\n');
+    if (!inicial.empty() && inicial.back() == '\r') inicial.remove_suffix(1);
+    string_view metodo = cortarCampo(inicial, ' ');
+    string_view destino = cortarCampo(inicial, ' ');
+    string_view version = inicial;
+    if (metodo.empty() || destino.empty() || destino[0] != '/' || version.substr(0, 7) != "HTTP/1.")
+        return 400;
+
+    p = PeticionHTTP();
+    p.metodo = string(metodo);
+    p.mantener = version != "HTTP/1.0";
+    size_t largoCuerpo = 0;
+    bool formulario = false;
+    while (!cabeceras.empty()) {
+        string_view linea = cortarCampo(cabeceras, '\n');
+        if (!linea.empty() && linea.back() == '\r') linea.remove_suffix(1);
+        size_t dosPuntos = linea.find(':');
+        if (dosPuntos == string_view::npos) continue;
+        string_view nombre = linea.substr(0, dosPuntos);
+        string_view valor = recortar(linea.substr(dosPuntos + 1));
+        if (igualesSinMayusculas(nombre, "Content-Length")) {
+            auto [fin, ec] = from_chars(valor.data(), valor.data() + valor.size(), largoCuerpo);
+            if (ec != errc() || fin != valor.data() + valor.size()) return 400;
+            if (largoCuerpo > MAX_CUERPO_HTTP) return 413;
+        } else if (igualesSinMayusculas(nombre, "Transfer-Encoding")) {
+            return 501;
+        } else if (igualesSinMayusculas(nombre, "Connection")) {
+            if (igualesSinMayusculas(valor, "close")) p.mantener = false;
+            if (igualesSinMayusculas(valor, "keep-alive")) p.mantener = true;
+        } else if (igualesSinMayusculas(nombre, "Content-Type")) {
+            formulario = valor.substr(0, 33) == "application/x-www-form-urlencoded";
+        }
+    }
+
+    size_t inicioCuerpo = finCabeceras + 4;
+    if (datos.size() - inicioCuerpo < largoCuerpo) return 0;
+    largo = inicioCuerpo + largoCuerpo;
+
+    size_t pregunta = destino.find('?');
+    p.ruta = decodificarURL(destino.substr(0, pregunta));
+    if (pregunta != string_view::npos) leerParametros(destino.substr(pregunta + 1), p.parametros);
+    if (formulario) leerParametros(datos.substr(inicioCuerpo, largoCuerpo), p.parametros);
+    return 200;
+}
+
+const char* textoEstadoHTTP(int estado) {
+    switch (estado) {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 413: return "Payload Too Large";
+        case 431: return "Request Header Fields Too Large";
+        case 501: return "Not Implemented";
+        default: return "Internal Server Error";
+    }
 }
 
-// ============================================================================
-// ESTRUCTURAS
-// ============================================================================
+string respuestaHTTP(int estado, const string& json, bool mantener) {
+    string out = "HTTP/1.1 " + to_string(estado) + " " + textoEstadoHTTP(estado) + "\r\n";
+    out += "Content-Type: application/json; charset=utf-8\r\n";
+    out += "Content-Length: " + to_string(json.size()) + "\r\n";
+    out += mantener ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    return out + json;
+}
 
-/**
- * @struct Correo
- * @brief Representa un correo con metadatos e ID autogenerado.
- */
-struct Correo {
-    int id;
-    string remitente;
-    string asunto;
-    string cuerpo;
-    string fecha;
-};
+string errorJSON(const string& mensaje) { return "{\"error\":" + textoJSON(mensaje) + "}"; }
+
+/// Remitente, asunto y fecha de un correo como objeto JSON, sin cerrar.
+string resumenJSON(const Correo& c) {
+    return "{\"id\":" + to_string(c.id) + ",\"remitente\":" + textoJSON(c.remitente) +
+           ",\"asunto\":" + textoJSON(c.asunto) + ",\"fecha\":\"" + textoFecha(c.fecha) + "\"";
+}
 
 /**
- * @struct NodoCorreo
- * @brief Nodo del árbol binario que almacena un correo.
+ * @brief Atiende una petición con el motor (desde un hilo de la reserva).
+ * @return Código HTTP y cuerpo JSON de la respuesta.
  */
-struct NodoCorreo {
-    Correo data;
-    NodoCorreo* izq;
-    NodoCorreo* der;
-    NodoCorreo(Correo c) : data(c), izq(nullptr), der(nullptr) {}
-};
+pair<int, string> atenderPeticion(MotorBusqueda& motor, const PeticionHTTP& p) {
+    MedirLatencia medir(OP_HTTP);
+    bool get = p.metodo == "GET";
+    size_t limite = TAM_RANKING;
+    string textoLimite = p.parametro("limite");
+    if (!textoLimite.empty()) {
+        auto [fin, ec] = from_chars(textoLimite.data(), textoLimite.data() + textoLimite.size(), limite);
+        if (ec != errc() || fin != textoLimite.data() + textoLimite.size())
+            return {400, errorJSON("limite invalido")};
+        limite = min(limite, MAX_LIMITE_HTTP);
+    }
+    auto listaJSON = [&](const Resultados& r, bool conPuntaje) {
+        string out = "{\"total\":" + to_string(r.total()) +
+                     (r.totalAproximado() ? ",\"aproximado\":true" : "") + ",\"correos\":[";
+        bool primero = true;
+        for (const ResultadoRanking& res : r.tramo(0, limite)) {
+            if (!primero) out += ',';
+            primero = false;
+            out += resumenJSON(motor.correo(res));
+            if (conPuntaje) out += ",\"puntaje\":" + to_string(res.puntaje);
+            out += '}';
+        }
+        return out + "]}";
+    };
+    auto leerId = [&](int& id) {
+        string texto = p.parametro("id");
+        auto [fin, ec] = from_chars(texto.data(), texto.data() + texto.size(), id);
+        return ec == errc() && fin == texto.data() + texto.size() && !texto.empty();
+    };
+
+    if (p.ruta == "/buscar") {
+        if (!get) return {405, errorJSON("use GET")};
+        return {200, listaJSON(motor.buscar(p.parametro("q"), limite), true)};
+    }
+    if (p.ruta == "/remitente") {
+        if (!get) return {405, errorJSON("use GET")};
+        return {200, listaJSON(motor.porRemitente(p.parametro("patron")), false)};
+    }
+    if (p.ruta == "/fechas") {
+        if (!get) return {405, errorJSON("use GET")};
+        Fecha desde = 0, hasta = FECHA_MAXIMA;
+        string textoDesde = p.parametro("desde"), textoHasta = p.parametro("hasta");
+        if ((!textoDesde.empty() && !leerFecha(textoDesde, desde, true)) ||
+            (!textoHasta.empty() && !leerFecha(textoHasta, hasta, true)))
+            return {400, errorJSON("fecha invalida")};
+        string correos;
+        size_t total = 0;
+        for (CursorFechas cursor = motor.porFechas(desde, hasta); cursor.valido();
+             cursor.avanzar(), total++) {
+            if (total >= limite) continue;
+            if (total > 0) correos += ',';
+            correos += resumenJSON(*cursor.actual()) + '}';
+        }
+        return {200, "{\"total\":" + to_string(total) + ",\"correos\":[" + correos + "]}"};
+    }
+    if (p.ruta == "/correo") {
+        int id;
+        if (!leerId(id)) return {400, errorJSON("id invalido")};
+        if (p.metodo == "DELETE") {
+            if (!motor.borrar(id)) return {404, errorJSON("no existe un correo con ese id")};
+            if (!motor.confirmar()) return {500, errorJSON("no se pudo guardar el borrado")};
+            return {200, "{\"borrado\":" + to_string(id) + "}"};
+        }
+        if (!get) return {405, errorJSON("use GET o DELETE")};
+        const Correo* c = motor.correo(id);
+        if (!c) return {404, errorJSON("no existe un correo con ese id")};
+        return {200, resumenJSON(*c) + ",\"cuerpo\":" + textoJSON(motor.cuerpo(*c)) + "}"};
+    }
+    if (p.ruta == "/estadisticas") {
+        if (!get) return {405, errorJSON("use GET")};
+        if (!estadisticasActivas.load(memory_order_relaxed))
+            return {404, errorJSON("inicie el servidor con --estadisticas")};
+        return {200, estadisticasJSON()};
+    }
+    if (p.ruta == "/correos") {
+        if (p.metodo != "POST") return {405, errorJSON("use POST")};
+        string rem = p.parametro("remitente");
+        Fecha fecha;
+        if (recortar(rem).empty() || !leerFecha(p.parametro("fecha"), fecha))
+            return {400, errorJSON("remitente vacio o fecha invalida")};
+        const Correo& c =
+            motor.agregar(rem, p.parametro("asunto"), p.parametro("cuerpo"), fecha);
+        if (!motor.confirmar()) return {500, errorJSON("no se pudo guardar el correo")};
+        return {201, "{\"id\":" + to_string(c.id) + "}"};
+    }
+    return {404, errorJSON("ruta desconocida")};
+}
+
+/// Se pone en 1 (desde una señal) para que ServidorHTTP::ejecutar() termine.
+volatile sig_atomic_t detenerServidor = 0;
+
+void pedirDetencion(int) { detenerServidor = 1; }
 
 /**
- * @class ArbolCorreos
- * @brief Árbol binario ordenado por fecha del correo.
+ * @class ServidorHTTP
+ * @brief Bucle de eventos sobre los sockets y reserva de hilos que atiende
+ *        las peticiones (ver el comentario de la sección).
  */
-class ArbolCorreos {
+class ServidorHTTP {
 private:
-    NodoCorreo* raiz;
+    struct Conexion {
+        Socket s;
+        string entrada;           ///< Bytes recibidos y no consumidos
+        string salida;            ///< Respuesta pendiente de enviar
+        size_t enviados = 0;
+        bool ocupada = false;     ///< Tiene una petición en la reserva
+        bool cerrarAlEnviar = false;
+    };
 
-    /**
-     * @brief Inserta un nodo basado en comparación de fecha.
-     */
-    NodoCorreo* insertar(NodoCorreo* nodo, Correo c) {
-        if (!nodo) return new NodoCorreo(c);
-        if (c.fecha < nodo->data.fecha)
-            nodo->izq = insertar(nodo->izq, c);
-        else
-            nodo->der = insertar(nodo->der, c);
-        return nodo;
+    struct Respuesta {
+        uint64_t conexion;
+        string texto;
+        bool cerrar;
+    };
+
+    MotorBusqueda& motor;
+    ReservaHilos reserva;
+    Socket escucha = SOCKET_INVALIDO;
+    Socket despertador = SOCKET_INVALIDO;   ///< UDP local; lo escriben los trabajadores
+    sockaddr_in direccionDespertador{};
+    unordered_map<uint64_t, Conexion> conexiones;   ///< Solo las usa el bucle
+    uint64_t siguienteConexion = 1;
+
+    mutex mutexListas;
+    vector<Respuesta> listas;   ///< Respuestas terminadas (protegidas por mutexListas)
+
+    void despertar() {
+        char uno = 1;
+        sendto(despertador, &uno, 1, 0, (const sockaddr*)&direccionDespertador,
+               sizeof direccionDespertador);
     }
 
-    /**
-     * @brief Recorrido inOrden para obtener correos ordenados.
-     */
-    void inOrden(NodoCorreo* nodo, vector<Correo>& lista) {
-        if (!nodo) return;
-        inOrden(nodo->izq, lista);
-        lista.push_back(nodo->data);
-        inOrden(nodo->der, lista);
+    void aceptar() {
+        while (true) {
+            Socket s = accept(escucha, nullptr, nullptr);
+            if (s == SOCKET_INVALIDO) return;
+            if (!sinBloqueo(s)) {
+                cerrarSocket(s);
+                continue;
+            }
+            conexiones[siguienteConexion++].s = s;
+        }
+    }
+
+    void responderAhora(Conexion& c, int estado, const string& json) {
+        c.salida = respuestaHTTP(estado, json, false);
+        c.enviados = 0;
+        c.cerrarAlEnviar = true;
+    }
+
+    /// Pasa a la reserva la siguiente petición completa de la conexión.
+    void despachar(uint64_t numero, Conexion& c) {
+        if (c.ocupada || !c.salida.empty() || c.cerrarAlEnviar) return;
+        auto p = make_shared<PeticionHTTP>();
+        size_t largo = 0;
+        int estado = analizarPeticion(c.entrada, *p, largo);
+        if (estado == 0) return;
+        if (estado != 200) {
+            responderAhora(c, estado, errorJSON(textoEstadoHTTP(estado)));
+            return;
+        }
+        c.entrada.erase(0, largo);
+        c.ocupada = true;
+        reserva.encolar([this, numero, p] {
+            pair<int, string> r = atenderPeticion(motor, *p);
+            {
+                lock_guard<mutex> bloqueo(mutexListas);
+                listas.push_back({numero, respuestaHTTP(r.first, r.second, p->mantener),
+                                  !p->mantener});
+            }
+            despertar();
+        });
+    }
+
+    void recibirListas() {
+        char basura[256];
+        while (recv(despertador, basura, sizeof basura, 0) > 0) {}
+        vector<Respuesta> tomadas;
+        {
+            lock_guard<mutex> bloqueo(mutexListas);
+            tomadas.swap(listas);
+        }
+        for (Respuesta& r : tomadas) {
+            auto it = conexiones.find(r.conexion);
+            if (it == conexiones.end()) continue;   // El cliente se fue antes
+            it->second.ocupada = false;
+            it->second.salida = move(r.texto);
+            it->second.enviados = 0;
+            it->second.cerrarAlEnviar = r.cerrar;
+        }
+    }
+
+    /// @return false si la conexión debe cerrarse.
+    bool leer(Conexion& c) {
+        char buffer[16 << 10];
+        while (true) {
+            int n = (int)recv(c.s, buffer, sizeof buffer, 0);
+            if (n > 0) {
+                c.entrada.append(buffer, (size_t)n);
+                if (c.entrada.size() > MAX_CABECERAS_HTTP + MAX_CUERPO_HTTP) return false;
+                continue;
+            }
+            return n < 0 && reintentable();
+        }
+    }
+
+    /// @return false si la conexión debe cerrarse.
+    bool escribir(Conexion& c) {
+        while (c.enviados < c.salida.size()) {
+#if defined(MSG_NOSIGNAL)
+            int n = (int)send(c.s, c.salida.data() + c.enviados, c.salida.size() - c.enviados,
+                              MSG_NOSIGNAL);
+#else
+            int n = (int)send(c.s, c.salida.data() + c.enviados,
+                              (int)(c.salida.size() - c.enviados), 0);
+#endif
+            if (n <= 0) return n < 0 && reintentable();
+            c.enviados += (size_t)n;
+        }
+        c.salida.clear();
+        c.enviados = 0;
+        return !c.cerrarAlEnviar;
     }
 
 public:
-    ArbolCorreos() : raiz(nullptr) {}
+    ServidorHTTP(MotorBusqueda& m, unsigned hilos) : motor(m), reserva(hilos) {}
+    ServidorHTTP(const ServidorHTTP&) = delete;
+    ServidorHTTP& operator=(const ServidorHTTP&) = delete;
+
+    ~ServidorHTTP() {
+        // Las tareas en curso deben terminar antes de cerrar los sockets
+        reserva.esperar();
+        for (auto& [numero, c] : conexiones) cerrarSocket(c.s);
+        if (escucha != SOCKET_INVALIDO) cerrarSocket(escucha);
+        if (despertador != SOCKET_INVALIDO) cerrarSocket(despertador);
+    }
 
     /**
-     * @brief Inserta un correo en el árbol.
+     * @brief Abre el puerto de escucha en la dirección IPv4 `host` y el
+     *        socket despertador.
+     * @return false si la dirección no es válida o algún socket no pudo
+     *         abrirse.
      */
-    void insertar(Correo c) { raiz = insertar(raiz, c); }
+    bool abrir(const string& host, uint16_t puerto) {
+        sockaddr_in dir{};
+        dir.sin_family = AF_INET;
+        dir.sin_port = htons(puerto);
+        if (inet_pton(AF_INET, host == "localhost" ? "127.0.0.1" : host.c_str(), &dir.sin_addr) != 1)
+            return false;
+
+        escucha = socket(AF_INET, SOCK_STREAM, 0);
+        despertador = socket(AF_INET, SOCK_DGRAM, 0);
+        if (escucha == SOCKET_INVALIDO || despertador == SOCKET_INVALIDO) return false;
+
+        int si = 1;
+        setsockopt(escucha, SOL_SOCKET, SO_REUSEADDR, (const char*)&si, sizeof si);
+        if (::bind(escucha, (const sockaddr*)&dir, sizeof dir) != 0 ||
+            listen(escucha, SOMAXCONN) != 0 || !sinBloqueo(escucha))
+            return false;
+
+        // El despertador se escucha a sí mismo en un puerto local libre
+        direccionDespertador.sin_family = AF_INET;
+        direccionDespertador.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        direccionDespertador.sin_port = 0;
+        socklen_t largo = sizeof direccionDespertador;
+        return ::bind(despertador, (const sockaddr*)&direccionDespertador,
+                      sizeof direccionDespertador) == 0 &&
+               getsockname(despertador, (sockaddr*)&direccionDespertador, &largo) == 0 &&
+               sinBloqueo(despertador);
+    }
 
     /**
-     * @brief Obtiene los correos ordenados por fecha.
+     * @brief Atiende conexiones hasta que detenerServidor se ponga en true.
      */
-    vector<Correo> obtenerOrdenados() {
-        vector<Correo> lista;
-        inOrden(raiz, lista);
-        return lista;
+    void ejecutar() {
+        vector<pollfd> sockets;
+        vector<uint64_t> numeros;   ///< Conexión de cada socket desde el tercero
+        while (!detenerServidor) {
+            sockets.assign({{escucha, POLLIN, 0}, {despertador, POLLIN, 0}});
+            numeros.clear();
+            for (auto& [numero, c] : conexiones) {
+                short eventos = 0;
+                if (!c.salida.empty()) eventos |= POLLOUT;
+                else if (!c.ocupada && !c.cerrarAlEnviar) eventos |= POLLIN;
+                sockets.push_back({c.s, eventos, 0});
+                numeros.push_back(numero);
+            }
+            if (esperarSockets(sockets, ESPERA_BUCLE_MS) <= 0) continue;
+
+            if (sockets[1].revents & POLLIN) recibirListas();
+            for (size_t i = 2; i < sockets.size(); i++) {
+                auto it = conexiones.find(numeros[i - 2]);
+                Conexion& c = it->second;
+                short ev = sockets[i].revents;
+                bool viva = true;
+                if (ev & (POLLERR | POLLNVAL)) viva = false;
+                if (viva && (ev & (POLLIN | POLLHUP))) viva = leer(c);
+                if (viva && !c.salida.empty()) viva = escribir(c);
+                if (viva) despachar(it->first, c);
+                if (viva && !c.salida.empty()) viva = escribir(c);
+                if (!viva) {
+                    cerrarSocket(c.s);
+                    conexiones.erase(it);
+                }
+            }
+            // Las conexiones nuevas entran al final, para no invalidar `numeros`
+            if (sockets[0].revents & POLLIN) aceptar();
+        }
     }
 };
 
 // ============================================================================
-// ESTRUCTURAS GLOBALES
+// BENCHMARK Y CORPUS SINTÉTICO
 // ============================================================================
-unordered_map<string, vector<Correo>> correosPorRemitente;
-unordered_map<int, unordered_map<string, int>> matrizDispersa;
-unordered_map<int, Correo> correosPorID;
+/*
+ * --generar-corpus archivo escribe un corpus sintético con el formato de
+ * correos.txt; --benchmark genera uno en un directorio temporal, lo carga
+ * con un MotorBusqueda y mide la carga, las altas, las búsquedas de uno y
+ * varios términos, las búsquedas por remitente y el recorrido por fecha.
+ *
+ * Las palabras siguen una distribución de Zipf sobre un vocabulario fijo
+ * y los remitentes otra más sesgada, de modo que unos pocos acaparan la
+ * mayoría de los correos, como en un buzón real. Con la misma semilla el
+ * corpus y las consultas son los mismos, así que dos corridas se pueden
+ * comparar. Las consultas repetidas se responden desde la caché, como en
+ * uso real; el informe final muestra cuántas fueron.
+ */
+
+/// Palabras distintas del vocabulario sintético.
+const size_t TAM_VOCABULARIO_SINTETICO = 20000;
+/// Remitentes distintos y dominios entre los que se reparten.
+const size_t REMITENTES_SINTETICOS = 5000;
+const size_t DOMINIOS_SINTETICOS = 40;
+/// Exponentes de Zipf de las palabras y de los remitentes.
+const double EXPONENTE_ZIPF_PALABRAS = 1.0;
+const double EXPONENTE_ZIPF_REMITENTES = 1.2;
 
-// ============================================================================
-// CREAR CORREO (INDEXACIÓN + MAPAS + MATRIZ DISPERSA)
-// ============================================================================
 /**
- * @brief Crea un correo nuevo, lo indexa y actualiza estructuras globales.
+ * @class DistribucionZipf
+ * @brief Rangos 0..n-1 con probabilidad proporcional a 1 / (rango + 1)^s,
+ *        muestreados con una búsqueda binaria sobre la acumulada.
  */
-Correo crearCorreo(string rem, string asu, string cue, string fecha) {
-    static int nextID = 1;
-    Correo c = {nextID++, rem, asu, cue, fecha};
+class DistribucionZipf {
+private:
+    vector<double> acumulada;
+
+public:
+    DistribucionZipf(size_t n, double s) : acumulada(n) {
+        double suma = 0;
+        for (size_t i = 0; i < n; i++) acumulada[i] = suma += 1.0 / pow((double)(i + 1), s);
+        for (double& a : acumulada) a /= suma;
+    }
 
-    // Indexación por remitente y por ID
-    correosPorRemitente[c.remitente].push_back(c);
-    correosPorID[c.id] = c;
+    template <class Generador>
+    size_t operator()(Generador& g) {
+        double u = uniform_real_distribution<double>(0.0, 1.0)(g);
+        size_t i = (size_t)(lower_bound(acumulada.begin(), acumulada.end(), u) - acumulada.begin());
+        return min(i, acumulada.size() - 1);
+    }
+};
 
-    // Conversión a minúsculas
-    auto aMinusculas = [](string s) {
-        for (char &ch : s) ch = tolower(ch);
-        return s;
-    };
+/**
+ * @class CorpusSintetico
+ * @brief Genera correos y consultas sintéticos reproducibles a partir de
+ *        una semilla.
+ */
+class CorpusSintetico {
+private:
+    mt19937_64 azar;
+    vector<string> vocabulario;   ///< Por rango: la primera es la más frecuente
+    vector<string> remitentes;
+    DistribucionZipf zipfPalabras, zipfRemitentes;
 
-    string texto = aMinusculas(asu + " " + cue);
-    string palabra;
+    /// Palabra i: sílabas de dos letras, así que no se repiten.
+    static string palabra(size_t i) {
+        static const char* const SILABAS[] = {"ca", "de", "li", "mo", "ra", "to", "su", "ne",
+                                              "pa", "ri", "lo", "ve", "ga", "mi", "so", "te",
+                                              "ba", "co", "du", "fi", "ja", "ke", "lu", "na",
+                                              "pe", "xo", "ro", "sa", "ti", "za"};
+        const size_t n = size(SILABAS);
+        string out;
+        do {
+            out += SILABAS[i % n];
+            i /= n;
+        } while (i > 0 || out.size() < 4);
+        return out;
+    }
 
-    // Construcción de la matriz dispersa
-    for (char ch : texto) {
-        if (isalnum((unsigned char)ch))
-            palabra += ch;
-        else {
-            if (!palabra.empty()) {
-                matrizDispersa[c.id][palabra] = 1;
-                palabra.clear();
-            }
+    void agregarPalabras(string& out, size_t minimo, size_t maximo) {
+        size_t n = uniform_int_distribution<size_t>(minimo, maximo)(azar);
+        for (size_t i = 0; i < n; i++) {
+            if (i > 0) out += ' ';
+            out += termino();
         }
     }
-    if (!palabra.empty())
-        matrizDispersa[c.id][palabra] = 1;
 
-    return c;
+public:
+    explicit CorpusSintetico(uint64_t semilla)
+        : azar(semilla),
+          zipfPalabras(TAM_VOCABULARIO_SINTETICO, EXPONENTE_ZIPF_PALABRAS),
+          zipfRemitentes(REMITENTES_SINTETICOS, EXPONENTE_ZIPF_REMITENTES) {
+        for (size_t i = 0; i < TAM_VOCABULARIO_SINTETICO; i++) vocabulario.push_back(palabra(i));
+        for (size_t i = 0; i < REMITENTES_SINTETICOS; i++)
+            remitentes.push_back(palabra(i) + "." + to_string(i) + "@" +
+                                 palabra(i % DOMINIOS_SINTETICOS) + ".com");
+    }
+
+    const string& termino() { return vocabulario[zipfPalabras(azar)]; }
+    const string& remitente() { return remitentes[zipfRemitentes(azar)]; }
+
+    /// Dominio de un remitente, como patrón "@dominio".
+    string dominio() {
+        const string& r = remitente();
+        return r.substr(r.find('@'));
+    }
+
+    /// Fecha uniforme entre 2020 y 2025.
+    Fecha fecha() {
+        return empaquetarFecha(uniform_int_distribution<uint32_t>(2020, 2025)(azar),
+                               uniform_int_distribution<uint32_t>(1, 12)(azar),
+                               uniform_int_distribution<uint32_t>(1, 28)(azar));
+    }
+
+    /// Asunto de 3 a 8 palabras.
+    string asunto() {
+        string out;
+        agregarPalabras(out, 3, 8);
+        return out;
+    }
+
+    /// Cuerpo de 20 a 150 palabras.
+    string cuerpo() {
+        string out;
+        agregarPalabras(out, 20, 150);
+        return out;
+    }
+
+    /// Un correo con el formato de correos.txt, sin el salto de línea.
+    string linea() {
+        string out = remitente() + ";" + asunto() + ";" + cuerpo() + "; " + textoFecha(fecha());
+        return out;
+    }
+};
+
+/**
+ * @brief Escribe `n` correos sintéticos, uno por línea.
+ * @return false si no se pudo escribir.
+ */
+bool generarCorpus(const string& nombreArchivo, size_t n, uint64_t semilla) {
+    ofstream out(nombreArchivo, ios::binary);
+    if (!out.is_open()) return false;
+    CorpusSintetico corpus(semilla);
+    for (size_t i = 0; i < n; i++) out << corpus.linea() << '\n';
+    return (bool)out.flush();
 }
 
-// ============================================================================
-// LEER ARCHIVO TXT
-// ============================================================================
 /**
- * @brief Carga correos desde un archivo con formato:
- *        remitente;asunto;cuerpo;fecha
+ * @struct OpcionesBenchmark
+ * @brief Tamaño y semilla de ejecutarBenchmark().
  */
-void cargarCorreosDesdeArchivo(string nombreArchivo, ArbolCorreos &arbol) {
-    ifstream file(nombreArchivo);
-    if (!file.is_open()) {
-        cout << RED << "No se pudo abrir el archivo.\n" << RESET;
-        return;
+struct OpcionesBenchmark {
+    size_t correos = 100000;    ///< Correos del corpus que se carga
+    size_t consultas = 20000;   ///< Repeticiones de cada tipo de búsqueda
+    size_t altas = 2000;        ///< Correos que se agregan uno por uno
+    uint64_t semilla = 1;
+    unsigned hilosCarga = 0;    ///< 0 = según los núcleos disponibles
+};
+
+/// Recorridos completos por fecha que se miden.
+const size_t RECORRIDOS_BENCHMARK = 5;
+/// Correos de cada página en las páginas por fecha que se miden.
+const size_t TAM_PAGINA_BENCHMARK = 50;
+
+/**
+ * @brief Genera un corpus, lo carga y mide cada operación en su propio
+ *        histograma. Escribe en `out` una tabla con latencias y
+ *        asignaciones por operación y después informeEstadisticas().
+ * @return false si no se pudo preparar el corpus.
+ */
+bool ejecutarBenchmark(const OpcionesBenchmark& opciones, ostream& out) {
+    namespace fs = filesystem;
+    error_code ec;
+    fs::path directorio = fs::temp_directory_path(ec) /
+        ("buscador-benchmark-" + to_string(chrono::steady_clock::now().time_since_epoch().count()));
+    if (ec || !fs::create_directories(directorio, ec)) return false;
+
+    ConfiguracionMotor config;
+    config.archivoCorreos = (directorio / "correos.txt").string();
+    config.archivoInstantanea = (directorio / "correos.idx").string();
+    config.archivoDiario = (directorio / "correos.wal").string();
+    config.hilosCarga = opciones.hilosCarga;
+    config.mantenimiento = false;
+    if (!generarCorpus(config.archivoCorreos, opciones.correos, opciones.semilla)) {
+        fs::remove_all(directorio, ec);
+        return false;
     }
+    uint64_t bytesCorpus = fs::file_size(config.archivoCorreos, ec);
+    estadisticasActivas = true;
 
-    string linea;
-    while (getline(file, linea)) {
-        stringstream ss(linea);
-        string rem, asu, cue, fec;
+    string tabla = encabezadoLatencias();
+    tabla.pop_back();
+    tabla += "    asig/op\n";
+    // Mide `veces` llamadas a `f` y agrega su fila a la tabla
+    auto medir = [&](const string& nombre, size_t veces, const auto& f) {
+        HistogramaLatencia h;
+        uint64_t antes = asignaciones.load(memory_order_relaxed);
+        for (size_t i = 0; i < veces; i++) {
+            auto inicio = chrono::steady_clock::now();
+            f();
+            h.registrar((uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+                            chrono::steady_clock::now() - inicio).count());
+        }
+        uint64_t asig = asignaciones.load(memory_order_relaxed) - antes;
+        string fila = filaLatencia(nombre, h);
+        fila.pop_back();
+        char porOp[32];
+        if (CONTAR_ASIGNACIONES)
+            snprintf(porOp, sizeof porOp, " %10.1f\n", veces ? (double)asig / veces : 0.0);
+        else
+            snprintf(porOp, sizeof porOp, " %10s\n", "n/a");
+        tabla += fila + porOp;
+        return h.media();
+    };
+
+    {
+        MotorBusqueda motor;
+        uint64_t nsCarga = medir("carga", 1, [&] { motor.abrir(config); });
+        for (const string& aviso : motor.avisos()) cerr << aviso << "\n";
+        double segundos = nsCarga / 1e9;
+        out << "Corpus: " << opciones.correos << " correos, " << bytesCorpus << " bytes (semilla "
+            << opciones.semilla << ")\n";
+        if (segundos > 0) {
+            char ritmo[96];
+            snprintf(ritmo, sizeof ritmo, "Carga: %.0f correos/s, %.1f MB/s\n",
+                     opciones.correos / segundos, bytesCorpus / 1e6 / segundos);
+            out << ritmo;
+        }
 
-        getline(ss, rem, ';');
-        getline(ss, asu, ';');
-        getline(ss, cue, ';');
-        getline(ss, fec, ';');
+        // Una semilla distinta de la del corpus para las consultas
+        CorpusSintetico azar(opciones.semilla + 1);
+        medir("alta", opciones.altas, [&] {
+            motor.agregar(azar.remitente(), azar.asunto(), azar.cuerpo(), azar.fecha());
+        });
+        motor.confirmar();
 
-        if (rem.empty()) continue;
+        size_t encontrados = 0;
+        medir("buscar 1 termino", opciones.consultas,
+              [&] { encontrados += motor.buscar(azar.termino()).tamano(); });
+        medir("buscar 2 terminos AND", opciones.consultas, [&] {
+            encontrados += motor.buscar(azar.termino() + " " + azar.termino()).tamano();
+        });
+        medir("buscar 2 terminos OR", opciones.consultas, [&] {
+            encontrados += motor.buscar(azar.termino() + " OR " + azar.termino()).tamano();
+        });
+        medir("remitente", opciones.consultas,
+              [&] { encontrados += motor.porRemitente(azar.remitente()).tamano(); });
+        medir("remitente @dominio", opciones.consultas,
+              [&] { encontrados += motor.porRemitente(azar.dominio()).tamano(); });
+        medir("fechas pagina", opciones.consultas, [&] {
+            Fecha desde = azar.fecha();
+            encontrados += motor.porFechas(desde).siguientes(TAM_PAGINA_BENCHMARK).size();
+        });
+        medir("fechas recorrido", RECORRIDOS_BENCHMARK, [&] {
+            for (CursorFechas cursor = motor.porFechas(); cursor.valido(); cursor.avanzar())
+                encontrados++;
+        });
 
-        Correo c = crearCorreo(rem, asu, cue, fec);
-        arbol.insertar(c);
+        out << "\nOperaciones (" << encontrados << " resultados en total):\n" << tabla << "\n";
+        out << informeEstadisticas();
+        motor.cerrar();
     }
-
-    file.close();
-    cout << GREEN << "Correos cargados correctamente.\n" << RESET;
+    fs::remove_all(directorio, ec);
+    return true;
 }
 
 // ============================================================================
@@ -209,145 +7085,457 @@ void cargarCorreosDesdeArchivo(string nombreArchivo, ArbolCorreos &arbol) {
 /**
  * @brief Muestra un correo completo en pantalla.
  */
-void verCorreo(const Correo &c) {
+void verCorreo(const MotorBusqueda& motor, const Correo &c) {
     limpiarPantalla();
     cout << BOLD << WHITE << "[ LEYENDO MENSAJE ]" << RESET << "\n\n";
 
     cout << GREEN << "ID: " << RESET << c.id << "\n";
     cout << GREEN << "Remitente: " << RESET << WHITE << c.remitente << RESET << "\n";
     cout << GREEN << "Asunto: " << RESET << RED << c.asunto << RESET << "\n";
-    cout << GREEN << "Fecha: " << RESET << WHITE << c.fecha << "\n\n";
+    cout << GREEN << "Fecha: " << RESET << WHITE << textoFecha(c.fecha) << "\n\n";
 
-    cout << WHITE << c.cuerpo << RESET << "\n\n";
+    cout << WHITE << motor.cuerpo(c) << RESET << "\n\n";
     cout << "Presione ENTER para volver...";
     cin.ignore();
     cin.get();
 }
 
 /**
- * @brief Despliega la lista de correos ordenados por fecha.
+ * @brief Despliega, página por página, los correos ordenados por fecha
+ *        dentro de un intervalo opcional [desde, hasta).
  */
-void verOrdenados(ArbolCorreos& arbol) {
-    vector<Correo> lista = arbol.obtenerOrdenados();
+void verOrdenados(const MotorBusqueda& motor) {
     limpiarPantalla();
-
     cout << BOLD << WHITE << "[ CORREOS ORDENADOS POR FECHA ]" << RESET << "\n\n";
 
-    for (auto &c : lista) {
-        cout << GREEN << c.id << RESET << "  "
-             << WHITE << c.remitente << RESET << "  "
-             << RED << c.asunto << RESET << "  "
-             << WHITE << c.fecha << RESET << "\n";
+    string textoDesde, textoHasta;
+    cin.ignore();
+    cout << "Fecha desde (AAAA, AAAA-MM o AAAA-MM-DD, ENTER para todas): ";
+    getline(cin, textoDesde);
+    cout << "Fecha hasta, sin incluir (AAAA, AAAA-MM o AAAA-MM-DD, ENTER para todas): ";
+    getline(cin, textoHasta);
+
+    Fecha desde = 0, hasta = FECHA_MAXIMA;
+    if ((!textoDesde.empty() && !leerFecha(recortar(textoDesde), desde, true)) ||
+        (!textoHasta.empty() && !leerFecha(recortar(textoHasta), hasta, true))) {
+        cout << RED << "Fecha invalida." << RESET;
+        cin.get();
+        return;
     }
 
-    cout << "\nIngrese ID de correo para abrirlo o 0 para volver: ";
-    int id; cin >> id;
+    CursorFechas cursor = motor.porFechas(desde, hasta);
+    int pagina = 1;
 
-    if (id != 0 && correosPorID.count(id)) {
-        cin.ignore();
-        verCorreo(correosPorID[id]);
+    while (true) {
+        vector<const Correo*> lista = cursor.siguientes(TAM_PAGINA);
+        limpiarPantalla();
+
+        cout << BOLD << WHITE << "[ CORREOS ORDENADOS POR FECHA - PAGINA "
+             << pagina << " ]" << RESET << "\n\n";
+
+        for (const Correo* c : lista) {
+            cout << GREEN << c->id << RESET << "  "
+                 << WHITE << c->remitente << RESET << "  "
+                 << RED << c->asunto << RESET << "  "
+                 << WHITE << textoFecha(c->fecha) << RESET << "\n";
+        }
+        if (lista.empty())
+            cout << RED << "No hay correos en ese intervalo." << RESET << "\n";
+
+        bool hayMas = cursor.valido();
+        cout << "\nIngrese ID de correo para abrirlo";
+        if (hayMas) cout << ", -1 para la siguiente pagina";
+        cout << " o 0 para volver: ";
+        int id; cin >> id;
+
+        if (id == -1 && hayMas) {
+            pagina++;
+            continue;
+        }
+
+        if (const Correo* c = motor.correo(id)) {
+            cin.ignore();
+            verCorreo(motor, *c);
+        }
+        return;
     }
 }
 
 /**
- * @brief Búsqueda de correos según remitente.
+ * @brief Búsqueda de correos según remitente: una dirección exacta, todo un
+ *        dominio ("@unal.edu.co") o las direcciones que comienzan de una
+ *        forma ("ana*"). Muestra los resultados por fecha, página por página.
  */
-void buscarRemitenteANSI() {
+void buscarRemitenteANSI(const MotorBusqueda& motor) {
     limpiarPantalla();
     cout << BOLD << WHITE << "[ BUSCAR POR REMITENTE ]" << RESET << "\n\n";
 
-    cout << "Ingrese remitente: ";
+    cout << "Ingrese remitente (direccion, @dominio o comienzo*): ";
     string rem;
     cin.ignore();
     getline(cin, rem);
 
-    if (!correosPorRemitente.count(rem)) {
+    Resultados lista = motor.porRemitente(rem);
+    if (lista.vacio()) {
         cout << RED << "No se encontraron correos de ese remitente." << RESET;
         cin.get();
         return;
     }
 
-    auto& lista = correosPorRemitente[rem];
+    for (size_t inicio = 0;; inicio += TAM_PAGINA) {
+        size_t fin = min(lista.tamano(), inicio + TAM_PAGINA);
+        limpiarPantalla();
+        cout << BOLD << WHITE << "[ RESULTADOS - PAGINA " << inicio / TAM_PAGINA + 1 << " DE "
+             << (lista.tamano() + TAM_PAGINA - 1) / TAM_PAGINA << " ]" << RESET << "\n\n";
+
+        for (size_t i = inicio; i < fin; i++) {
+            const Correo &c = motor.correo(lista[i]);
+            cout << GREEN << c.id << RESET << "  "
+                 << WHITE << c.remitente << RESET << "  "
+                 << WHITE << c.asunto << RESET << "  "
+                 << WHITE << textoFecha(c.fecha) << RESET << "\n";
+        }
+
+        bool hayMas = fin < lista.tamano();
+        cout << "\nIngrese ID para abrir correo";
+        if (hayMas) cout << ", -1 para la siguiente pagina";
+        cout << " o 0 para volver: ";
+        int id; cin >> id;
+
+        if (id == -1 && hayMas) continue;
+
+        if (const Correo* c = motor.correo(id)) {
+            cin.ignore();
+            verCorreo(motor, *c);
+        }
+        return;
+    }
+}
+
+/**
+ * @brief Búsqueda por palabra clave o consulta booleana usando el índice
+ *        invertido. Muestra los TAM_RANKING correos más relevantes según
+ *        BM25. El costo depende del tamaño de las listas involucradas, no
+ *        del total de correos.
+ */
+void buscarPalabraANSI(const MotorBusqueda& motor) {
+    limpiarPantalla();
+    cout << BOLD << WHITE << "[ BUSCAR PALABRA CLAVE ]" << RESET << "\n\n";
+
+    cout << "Ingrese palabra o consulta (ej: parcial AND NOT examen, entreg*, asunto:parcial,"
+            " de:unal.edu.co): ";
+    string consulta;
+    cin.ignore();
+    getline(cin, consulta);
+
+    Resultados ranking = motor.buscar(consulta);
 
     limpiarPantalla();
-    cout << BOLD << WHITE << "[ RESULTADOS ]" << RESET << "\n\n";
 
-    for (auto &c : lista) {
+    if (ranking.vacio()) {
+        cout << RED << "No se encontraron coincidencias." << RESET << "\n";
+
+        // Sugerencias para los términos que no existen en el índice
+        for (const auto& [t, similares] : motor.sugerencias(consulta)) {
+            cout << "\nQuiso decir (" << WHITE << t << RESET << "):";
+            for (const string& similar : similares)
+                cout << " " << GREEN << similar << RESET;
+            cout << "\n";
+        }
+        cin.get();
+        return;
+    }
+
+    cout << BOLD << WHITE << "[ RESULTADOS MAS RELEVANTES ]" << RESET << "\n";
+    if (ranking.total() > ranking.tamano())
+        cout << "Se muestran " << ranking.tamano() << " de "
+             << (ranking.totalAproximado() ? "unas " : "") << ranking.total() << " coincidencias.\n";
+    cout << "\n";
+
+    for (const ResultadoRanking& res : ranking) {
+        const Correo &c = motor.correo(res);
         cout << GREEN << c.id << RESET << "  "
-             << WHITE << c.asunto << RESET << "  "
-             << WHITE << c.fecha << RESET << "\n";
+             << RED << c.asunto << RESET << "  "
+             << WHITE << c.remitente << RESET
+             << "  " << WHITE << textoFecha(c.fecha) << RESET << "\n";
     }
 
     cout << "\nIngrese ID para abrir correo o 0 para volver: ";
     int id; cin >> id;
 
-    if (id != 0 && correosPorID.count(id)) {
+    if (const Correo* c = motor.correo(id)) {
         cin.ignore();
-        verCorreo(correosPorID[id]);
+        verCorreo(motor, *c);
     }
 }
 
 /**
- * @brief Búsqueda basada en la matriz dispersa por palabra clave.
+ * @brief Redacta un correo nuevo, lo indexa y lo deja guardado en el diario.
  */
-void buscarPalabraANSI() {
+void redactarCorreoANSI(MotorBusqueda& motor) {
     limpiarPantalla();
-    cout << BOLD << WHITE << "[ BUSCAR PALABRA CLAVE ]" << RESET << "\n\n";
+    cout << BOLD << WHITE << "[ REDACTAR CORREO ]" << RESET << "\n\n";
 
-    cout << "Ingrese palabra: ";
-    string palabra;
+    string rem, asu, cue, fec;
     cin.ignore();
-    getline(cin, palabra);
+    cout << "Remitente: ";
+    getline(cin, rem);
+    cout << "Asunto: ";
+    getline(cin, asu);
+    cout << "Cuerpo: ";
+    getline(cin, cue);
+    cout << "Fecha (AAAA-MM-DD): ";
+    getline(cin, fec);
 
-    for (char &c : palabra) c = tolower(c);
+    Fecha fecha;
+    if (rem.empty() || !leerFecha(fec, fecha)) {
+        cout << RED << "Remitente vacio o fecha invalida; no se creo el correo." << RESET;
+        cin.get();
+        return;
+    }
 
-    vector<int> resultados;
+    const Correo& c = motor.agregar(rem, asu, cue, fecha);
 
-    for (auto &fila : matrizDispersa) {
-        if (fila.second.count(palabra))
-            resultados.push_back(fila.first);
+    // Un correo redactado a mano debe ser durable antes de confirmarlo
+    if (!motor.confirmar()) {
+        cout << RED << "No se pudo guardar el correo en el diario." << RESET;
+        cin.get();
+        return;
     }
 
+    cout << GREEN << "Correo creado con ID " << c.id << "." << RESET;
+    cin.get();
+}
+
+/**
+ * @brief Borra un correo por ID, previa confirmación.
+ */
+void borrarCorreoANSI(MotorBusqueda& motor) {
     limpiarPantalla();
+    cout << BOLD << WHITE << "[ BORRAR CORREO ]" << RESET << "\n\n";
+
+    cout << "Ingrese ID del correo: ";
+    int id; cin >> id;
+    cin.ignore();
 
-    if (resultados.empty()) {
-        cout << RED << "No se encontraron coincidencias." << RESET;
+    const Correo* c = motor.correo(id);
+    if (!c) {
+        cout << RED << "No existe un correo con ese ID." << RESET;
         cin.get();
         return;
     }
 
-    cout << BOLD << WHITE << "[ RESULTADOS ]" << RESET << "\n\n";
+    cout << WHITE << c->remitente << RESET << "  " << RED << c->asunto << RESET << "  "
+         << WHITE << textoFecha(c->fecha) << RESET << "\n\n";
+    cout << "Confirma el borrado (s/n): ";
+    string respuesta;
+    getline(cin, respuesta);
+    if (respuesta != "s" && respuesta != "S") return;
 
-    for (int id : resultados) {
-        Correo &c = correosPorID[id];
-        cout << GREEN << c.id << RESET << "  "
-             << RED << c.asunto << RESET << "  "
-             << WHITE << c.remitente << RESET
-             << "  " << WHITE << c.fecha << RESET << "\n";
+    motor.borrar(id);
+    if (!motor.confirmar()) {
+        cout << RED << "No se pudo guardar el borrado en el diario." << RESET;
+        cin.get();
+        return;
     }
 
-    cout << "\nIngrese ID para abrir correo o 0 para volver: ";
+    cout << GREEN << "Correo borrado." << RESET;
+    cin.get();
+}
+
+/**
+ * @brief Edita un correo por ID; ENTER conserva el valor de cada campo. El
+ *        correo editado recibe un ID nuevo.
+ */
+void editarCorreoANSI(MotorBusqueda& motor) {
+    limpiarPantalla();
+    cout << BOLD << WHITE << "[ EDITAR CORREO ]" << RESET << "\n\n";
+
+    cout << "Ingrese ID del correo: ";
     int id; cin >> id;
+    cin.ignore();
 
-    if (id != 0 && correosPorID.count(id)) {
-        cin.ignore();
-        verCorreo(correosPorID[id]);
+    const Correo* c = motor.correo(id);
+    if (!c) {
+        cout << RED << "No existe un correo con ese ID." << RESET;
+        cin.get();
+        return;
+    }
+
+    string campos[4] = {c->remitente, c->asunto, motor.cuerpo(*c), textoFecha(c->fecha)};
+    const char* etiquetas[4] = {"Remitente", "Asunto", "Cuerpo", "Fecha (AAAA-MM-DD)"};
+    for (int i = 0; i < 4; i++) {
+        cout << etiquetas[i] << " [" << WHITE << campos[i] << RESET << "]: ";
+        string nuevo;
+        getline(cin, nuevo);
+        if (!nuevo.empty()) campos[i] = nuevo;
+    }
+
+    Fecha fecha;
+    if (recortar(campos[0]).empty() || !leerFecha(campos[3], fecha)) {
+        cout << RED << "Remitente vacio o fecha invalida; no se modifico el correo." << RESET;
+        cin.get();
+        return;
+    }
+
+    const Correo* editado = motor.editar(id, campos[0], campos[1], campos[2], fecha);
+    if (!editado || !motor.confirmar()) {
+        cout << RED << "No se pudo guardar el correo editado." << RESET;
+        cin.get();
+        return;
     }
+
+    cout << GREEN << "Correo editado; su nuevo ID es " << editado->id << "." << RESET;
+    cin.get();
 }
 
 // ============================================================================
 // PROGRAMA PRINCIPAL
 // ============================================================================
-int main() {
-    ArbolCorreos arbol;
+const string ARCHIVO_CORREOS = "correos.txt";
+const string ARCHIVO_INSTANTANEA = "correos.idx";
+const string ARCHIVO_DIARIO = "correos.wal";
+const string ARCHIVO_CUERPOS = "correos.cuerpos";
+const string HOST_SERVIDOR = "127.0.0.1";
+const uint16_t PUERTO_SERVIDOR = 8080;
+
+int main(int argc, char* argv[]) {
+    ConfiguracionMotor config;
+    config.archivoCorreos = ARCHIVO_CORREOS;
+    config.archivoInstantanea = ARCHIVO_INSTANTANEA;
+    config.archivoDiario = ARCHIVO_DIARIO;
+
+    // --lote [archivo] responde las consultas del archivo (o de la entrada
+    // estándar), una por línea, sin menú; --servidor [[host:]puerto] las atiende
+    // por HTTP; --benchmark mide las operaciones sobre un corpus sintético
+    // y --estadisticas mide las de cualquier modo
+    bool porLotes = false, comoServidor = false, benchmark = false;
+    string archivoLote, archivoCorpus;
+    OpcionesLote opcionesLote;
+    OpcionesBenchmark opcionesBenchmark;
+    string host = HOST_SERVIDOR;
+    uint16_t puerto = PUERTO_SERVIDOR;
+    for (int i = 1; i < argc; i++) {
+        string opcion = argv[i];
+        bool conValor = i + 1 < argc && string(argv[i + 1]).rfind("--", 0) != 0;
+        // Con --cuerpos-en-disco los cuerpos no ocupan memoria
+        if (opcion == "--cuerpos-en-disco") {
+            config.archivoCuerpos = ARCHIVO_CUERPOS;
+        } else if (opcion == "--lote") {
+            porLotes = true;
+            if (conValor) archivoLote = argv[++i];
+        } else if (opcion == "--servidor") {
+            comoServidor = true;
+            if (conValor) {
+                string_view valor = argv[++i];
+                size_t dosPuntos = valor.rfind(':');
+                if (dosPuntos != string_view::npos) {
+                    host = string(valor.substr(0, dosPuntos));
+                    valor = valor.substr(dosPuntos + 1);
+                }
+                puerto = (uint16_t)strtoul(string(valor).c_str(), nullptr, 10);
+            }
+        } else if (opcion == "--benchmark") {
+            benchmark = true;
+        } else if (opcion == "--generar-corpus" && conValor) {
+            archivoCorpus = argv[++i];
+        } else if (opcion == "--correos" && conValor) {
+            opcionesBenchmark.correos = (size_t)strtoull(argv[++i], nullptr, 10);
+        } else if (opcion == "--consultas" && conValor) {
+            opcionesBenchmark.consultas = (size_t)strtoull(argv[++i], nullptr, 10);
+        } else if (opcion == "--semilla" && conValor) {
+            opcionesBenchmark.semilla = strtoull(argv[++i], nullptr, 10);
+        } else if (opcion == "--estadisticas") {
+            estadisticasActivas = true;
+        } else if (opcion == "--json") {
+            opcionesLote.json = true;
+        } else if (opcion == "--hilos" && conValor) {
+            opcionesLote.hilos = (unsigned)strtoul(argv[++i], nullptr, 10);
+        } else if (opcion == "--limite" && conValor) {
+            opcionesLote.limite = (size_t)strtoull(argv[++i], nullptr, 10);
+        } else {
+            cerr << "Opcion desconocida: " << opcion << "\n";
+            return 1;
+        }
+    }
+
+    if (!archivoCorpus.empty()) {
+        if (!generarCorpus(archivoCorpus, opcionesBenchmark.correos, opcionesBenchmark.semilla)) {
+            cerr << "No se pudo escribir " << archivoCorpus << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    if (benchmark) {
+        opcionesBenchmark.hilosCarga = opcionesLote.hilos;
+        if (!ejecutarBenchmark(opcionesBenchmark, cout)) {
+            cerr << "No se pudo preparar el corpus del benchmark\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    if (porLotes) {
+        ios::sync_with_stdio(false);
+        config.mantenimiento = false;
+        MotorBusqueda motor;
+        motor.abrir(config);
+        for (const string& aviso : motor.avisos()) cerr << aviso << "\n";
+
+        ifstream archivo;
+        if (!archivoLote.empty()) {
+            archivo.open(archivoLote);
+            if (!archivo.is_open()) {
+                cerr << "No se pudo abrir " << archivoLote << "\n";
+                return 1;
+            }
+        }
+        ejecutarLote(motor, archivoLote.empty() ? cin : archivo, cout, opcionesLote);
+        if (estadisticasActivas) cerr << informeEstadisticas();
+        return 0;
+    }
+
+    if (comoServidor) {
+#ifdef _WIN32
+        WSADATA wsa;
+        if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+            cerr << "No se pudo iniciar Winsock\n";
+            return 1;
+        }
+#else
+        signal(SIGPIPE, SIG_IGN);
+#endif
+        signal(SIGINT, pedirDetencion);
+        signal(SIGTERM, pedirDetencion);
 
-    // Correos predefinidos
-    arbol.insertar(crearCorreo("juan@correo.com", "Reunion de equipo", "Reunion urgente mañana", "2025-11-10"));
-    arbol.insertar(crearCorreo("ana@correo.com", "Entrega de tarea", "La tarea esta lista", "2025-11-11"));
-    arbol.insertar(crearCorreo("luis@correo.com", "Proyecto nuevo", "Debemos entregar el reporte", "2025-11-09"));
+        MotorBusqueda motor;
+        motor.abrir(config);
+        for (const string& aviso : motor.avisos()) cerr << aviso << "\n";
+        {
+            ServidorHTTP servidor(motor, opcionesLote.hilos);
+            if (!servidor.abrir(host, puerto)) {
+                cerr << "No se pudo abrir " << host << ":" << puerto << "\n";
+                return 1;
+            }
+            cout << "Escuchando en " << host << ":" << puerto << " (Ctrl+C para terminar)" << endl;
+            servidor.ejecutar();
+        }
+        motor.cerrar();
+        if (estadisticasActivas) cerr << informeEstadisticas();
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return 0;
+    }
 
-    // Carga de archivo externo
-    cargarCorreosDesdeArchivo("correos.txt", arbol);
+    MotorBusqueda motor;
+    motor.abrir(config);
+    for (const string& aviso : motor.avisos()) cout << RED << aviso << "\n" << RESET;
+    if (!motor.avisos().empty()) {
+        cout << "Presione ENTER para continuar...";
+        cin.get();
+    }
 
     // Menú principal
     while (true) {
@@ -356,6 +7544,9 @@ int main() {
         cout << GREEN << "1" << RESET << ". Ver correos ordenados\n";
         cout << GREEN << "2" << RESET << ". Buscar por remitente\n";
         cout << GREEN << "3" << RESET << ". Buscar por palabra clave\n";
+        cout << GREEN << "4" << RESET << ". Redactar correo\n";
+        cout << GREEN << "5" << RESET << ". Borrar correo\n";
+        cout << GREEN << "6" << RESET << ". Editar correo\n";
         cout << GREEN << "0" << RESET << ". Salir\n\n";
 
         cout << "Seleccione una opcion: ";
@@ -363,10 +7554,14 @@ int main() {
         cin >> op;
 
         if (op == 0) break;
-        if (op == 1) verOrdenados(arbol);
-        else if (op == 2) buscarRemitenteANSI();
-        else if (op == 3) buscarPalabraANSI();
+        if (op == 1) verOrdenados(motor);
+        else if (op == 2) buscarRemitenteANSI(motor);
+        else if (op == 3) buscarPalabraANSI(motor);
+        else if (op == 4) redactarCorreoANSI(motor);
+        else if (op == 5) borrarCorreoANSI(motor);
+        else if (op == 6) editarCorreoANSI(motor);
     }
 
+    motor.cerrar();
     return 0;
 }